@@ -0,0 +1,263 @@
+/*
+  scara_bench.c - Host benchmark of the SCARA kinematics accuracy and cost
+  Part of Grbl
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Builds grbl/scara.c for the host with the default settings of defaults.h and sweeps a grid over
+// the square around the arm reach. Each reachable point runs inverse_kinematics(), the joint angles
+// are rounded to whole motor steps, and forward_kinematics_SCARA() maps them back. Reports the max
+// and RMS errors of the joint angles against a double precision solve and of both round trips, the
+// unreachable and near singular points, and the host time per call of each kinematics kernel. Built
+// by 'make bench', once with the float and once with the SCARA_FIXED_POINT_IK kernel.
+//
+//   scara_bench [grid spacing mm] [max round trip error mm]
+//
+// Exits with 1 if the quantised round trip error exceeds the given max, or any reachable point
+// fails to solve, so it gates changes to the kinematics. The max defaults to the half motor step at
+// full reach, the floor set by rounding the joints to whole steps, plus BENCH_GATE_MARGIN. NOTE: Host times are only comparable with each other. The Cortex-M3 has no FPU,
+// so float math costs it relatively more than on the host.
+
+#include "grbl.h"
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_GRID_DEFAULT 1.0 // mm
+#define BENCH_SINGULAR_SIN 0.05 // |sin(theta-psi)| below this is near singular. As SCARA_JACOBIAN_MIN_SIN.
+#define BENCH_JACOBIAN_STEP 0.1f // mm. Cartesian step of the timed Jacobian updates.
+#define BENCH_GATE_MARGIN 1.1 // Default max round trip error over the half step at full reach.
+
+// Grbl globals and calls used by scara.c.
+settings_t settings;
+int32_t sys_position[N_AXIS];
+void printString(const char *s) { fputs(s, stdout); }
+void printFloat(float n, uint8_t decimal_places) { printf("%.*f", decimal_places, n); }
+float system_convert_axis_steps_to_mpos(int32_t *steps, uint8_t idx) { return(steps[idx]/settings.steps_per_mm[idx]); }
+
+typedef struct {
+  double max, sum_sq;
+  uint32_t count;
+} bench_error_t;
+
+static void bench_error_add(bench_error_t *e, double error)
+{
+  error = fabs(error);
+  if (!(error <= e->max)) { e->max = error; } // Lets a NaN through to the report.
+  e->sum_sq += error*error;
+  e->count++;
+}
+
+static void bench_error_report(const char *name, const char *unit, bench_error_t *e)
+{
+  printf("  %-28s max %.6f  rms %.6f %s\n", name, e->max, (e->count ? sqrt(e->sum_sq/e->count) : 0.0), unit);
+}
+
+// Difference of two angles in degrees, wrapped to [-180,180].
+static double bench_angle_error(double a, double b)
+{
+  double d = fmod(a-b, 360.0);
+  if (d > 180.0) { d -= 360.0; } else if (d < -180.0) { d += 360.0; }
+  return(d);
+}
+
+// Double precision right or left-handed inverse kinematics of scara.c, as motor angles in degrees.
+static void bench_reference_ik(double x, double y, uint8_t elbow, double *joint)
+{
+  double l1 = settings.scara_linkage[0], l2 = settings.scara_linkage[1];
+  double u = -(x + settings.scara_offset[X_AXIS]);
+  double v = y + settings.scara_offset[Y_AXIS];
+  double c2 = (u*u + v*v - l1*l1 - l2*l2)/(2.0*l1*l2);
+  c2 = fmax(-1.0, fmin(1.0, c2));
+  double s2 = sqrt(1.0 - c2*c2);
+  if (elbow == SCARA_ELBOW_LEFT) { s2 = -s2; }
+  double theta = atan2(v, u) - atan2(l2*s2, l1 + l2*c2);
+  double psi = theta + atan2(s2, c2);
+  joint[X_AXIS] = theta*180.0/M_PI - settings.scara_joint_offset[X_AXIS];
+  joint[Y_AXIS] = psi*180.0/M_PI - settings.scara_joint_offset[Y_AXIS];
+}
+
+static double bench_now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return(t.tv_sec + 1e-9*t.tv_nsec);
+}
+
+static void bench_settings_init()
+{
+  settings.steps_per_mm[X_AXIS] = DEFAULT_X_STEPS_PER_MM;
+  settings.steps_per_mm[Y_AXIS] = DEFAULT_Y_STEPS_PER_MM;
+  settings.steps_per_mm[Z_AXIS] = DEFAULT_Z_STEPS_PER_MM;
+  settings.max_rate[X_AXIS] = DEFAULT_X_MAX_RATE;
+  settings.max_rate[Y_AXIS] = DEFAULT_Y_MAX_RATE;
+  settings.max_rate[Z_AXIS] = DEFAULT_Z_MAX_RATE;
+  settings.flags = 0; // Soft limits off. Joint limits are not part of the sweep.
+  settings.scara_linkage[0] = DEFAULT_SCARA_LINKAGE_1;
+  settings.scara_linkage[1] = DEFAULT_SCARA_LINKAGE_2;
+  settings.scara_offset[X_AXIS] = DEFAULT_SCARA_OFFSET_X;
+  settings.scara_offset[Y_AXIS] = DEFAULT_SCARA_OFFSET_Y;
+  settings.scara_joint_min[X_AXIS] = DEFAULT_SCARA_X_JOINT_MIN;
+  settings.scara_joint_max[X_AXIS] = DEFAULT_SCARA_X_JOINT_MAX;
+  settings.scara_joint_min[Y_AXIS] = DEFAULT_SCARA_Y_JOINT_MIN;
+  settings.scara_joint_max[Y_AXIS] = DEFAULT_SCARA_Y_JOINT_MAX;
+  settings.scara_elbow = SCARA_ELBOW_RIGHT;
+  settings.scara_joint_offset[X_AXIS] = DEFAULT_SCARA_X_JOINT_OFFSET;
+  settings.scara_joint_offset[Y_AXIS] = DEFAULT_SCARA_Y_JOINT_OFFSET;
+  scara_init();
+}
+
+int main(int argc, char **argv)
+{
+  double grid = (argc > 1) ? atof(argv[1]) : BENCH_GRID_DEFAULT;
+  double max_error = (argc > 2) ? atof(argv[2]) : 0.0;
+  if (!(grid > 0.0)) { fprintf(stderr, "scara_bench: bad grid spacing\n"); return(2); }
+  bench_settings_init();
+
+  double reach = settings.scara_linkage[0] + settings.scara_linkage[1];
+  double tower_x = -settings.scara_offset[X_AXIS], tower_y = -settings.scara_offset[Y_AXIS];
+  uint32_t n_side = (uint32_t)(2.0*reach/grid) + 1;
+  float (*point)[N_AXIS] = malloc((size_t)n_side*n_side*sizeof(*point));
+  float (*joint)[N_AXIS] = malloc((size_t)n_side*n_side*sizeof(*joint));
+  if ((point == NULL) || (joint == NULL)) { fprintf(stderr, "scara_bench: out of memory\n"); return(2); }
+
+  // Accuracy sweep.
+  uint32_t n_grid = 0, n_reachable = 0, n_unreachable = 0, n_singular = 0, n_failed = 0;
+  bench_error_t joint_error = {0}, kernel_error = {0}, step_error = {0}, singular_step_error = {0};
+  uint32_t i, j;
+  for (i=0; i<n_side; i++) {
+    for (j=0; j<n_side; j++) {
+      float target[N_AXIS] = { tower_x - reach + i*grid, tower_y - reach + j*grid, 0.0f };
+      float f_scara[N_AXIS], round_trip[N_AXIS];
+      n_grid++;
+      inverse_kinematics(target, f_scara, NULL);
+      if (scara_check_workspace(target, f_scara)) { n_unreachable++; continue; }
+      if (!(isfinite(f_scara[X_AXIS]) && isfinite(f_scara[Y_AXIS]))) { n_failed++; continue; }
+
+      forward_kinematics_SCARA(f_scara, round_trip);
+      bench_error_add(&kernel_error, hypot(round_trip[X_AXIS]-target[X_AXIS], round_trip[Y_AXIS]-target[Y_AXIS]));
+
+      // Round trip through whole motor steps, as the planner and steppers see it.
+      float stepped[N_AXIS];
+      uint8_t idx;
+      for (idx=0; idx<N_AXIS; idx++) {
+        stepped[idx] = lroundf(f_scara[idx]*settings.steps_per_mm[idx])/settings.steps_per_mm[idx];
+      }
+      forward_kinematics_SCARA(stepped, round_trip);
+      double error = hypot(round_trip[X_AXIS]-target[X_AXIS], round_trip[Y_AXIS]-target[Y_AXIS]);
+      double elbow_sin = sin((f_scara[Y_AXIS]-f_scara[X_AXIS] + settings.scara_joint_offset[Y_AXIS]
+                              - settings.scara_joint_offset[X_AXIS])*M_PI/180.0);
+      if (fabs(elbow_sin) < BENCH_SINGULAR_SIN) {
+        n_singular++;
+        bench_error_add(&singular_step_error, error);
+      } else {
+        // Joint angles are ill-defined near the singular poses, so only their position error counts.
+        double reference[N_AXIS];
+        bench_reference_ik(target[X_AXIS], target[Y_AXIS], settings.scara_elbow, reference);
+        bench_error_add(&joint_error, bench_angle_error(f_scara[X_AXIS], reference[X_AXIS]));
+        bench_error_add(&joint_error, bench_angle_error(f_scara[Y_AXIS], reference[Y_AXIS]));
+        bench_error_add(&step_error, error);
+      }
+
+      memcpy(point[n_reachable], target, sizeof(target));
+      memcpy(joint[n_reachable], f_scara, sizeof(f_scara));
+      n_reachable++;
+    }
+  }
+
+  // Quantisation floor. Both joints off by half a step at full reach.
+  double half_step = reach*(0.5/settings.steps_per_mm[X_AXIS])*M_PI/180.0;
+
+  #ifdef SCARA_FIXED_POINT_IK
+    printf("SCARA kinematics, fixed-point inverse kinematics kernel\n");
+  #else
+    printf("SCARA kinematics, float inverse kinematics kernel\n");
+  #endif
+  printf("  L1 %.3f  L2 %.3f  tower %.3f,%.3f  %.6f steps/deg  grid %.3f mm\n",
+         settings.scara_linkage[0], settings.scara_linkage[1], tower_x, tower_y, settings.steps_per_mm[X_AXIS], grid);
+  printf("  points %lu  reachable %lu  unreachable %lu  near singular %lu  failed %lu\n",
+         (unsigned long)n_grid, (unsigned long)n_reachable, (unsigned long)n_unreachable,
+         (unsigned long)n_singular, (unsigned long)n_failed);
+  bench_error_report("joint angle vs double", "deg", &joint_error);
+  bench_error_report("IK->FK round trip", "mm", &kernel_error);
+  bench_error_report("IK->steps->FK round trip", "mm", &step_error);
+  bench_error_report("  near singular", "mm", &singular_step_error);
+  printf("  half step at full reach %.6f mm\n", half_step);
+  if (!(max_error > 0.0)) { max_error = BENCH_GATE_MARGIN*half_step; }
+
+  // Cost per call. The results are summed into a volatile, so no call is optimized away.
+  volatile float sink = 0.0f;
+  float f_scara[N_AXIS], cartesian[N_AXIS];
+  double start;
+  uint32_t n;
+  printf("Host time per call\n");
+
+  start = bench_now();
+  for (n=0; n<n_reachable; n++) { inverse_kinematics(point[n], f_scara, joint[n]); sink += f_scara[X_AXIS]; }
+  printf("  %-28s %8.1f ns\n", "inverse_kinematics", 1e9*(bench_now()-start)/n_reachable);
+
+  float (*batch)[N_AXIS] = malloc((size_t)n_reachable*sizeof(*batch));
+  if (batch == NULL) { fprintf(stderr, "scara_bench: out of memory\n"); return(2); }
+  start = bench_now();
+  for (n=0; n+255<=n_reachable; n+=255) { inverse_kinematics_batch(&point[n], &batch[n], 255, joint[n]); }
+  printf("  %-28s %8.1f ns\n", "inverse_kinematics_batch", 1e9*(bench_now()-start)/max(n,1));
+  if (n) { sink += batch[n-1][X_AXIS]; }
+
+  start = bench_now();
+  for (n=0; n<n_reachable; n++) { forward_kinematics_SCARA(joint[n], cartesian); sink += cartesian[X_AXIS]; }
+  printf("  %-28s %8.1f ns\n", "forward_kinematics_SCARA", 1e9*(bench_now()-start)/n_reachable);
+
+  // Jacobian updates along a line from every grid point, restarted when the update refuses.
+  scara_jacobian_t jac;
+  float delta[N_AXIS] = { BENCH_JACOBIAN_STEP*0.6f, BENCH_JACOBIAN_STEP*0.8f, 0.0f };
+  uint32_t n_steps = 0;
+  start = bench_now();
+  for (n=0; n<n_reachable; n++) {
+    memcpy(f_scara, joint[n], sizeof(f_scara));
+    scara_jacobian_init(&jac, f_scara);
+    uint8_t k;
+    for (k=0; k<N_SCARA_CORRECTION; k++) {
+      if (!scara_jacobian_step(&jac, delta, f_scara)) { break; }
+      n_steps++;
+    }
+    sink += f_scara[X_AXIS];
+  }
+  printf("  %-28s %8.1f ns (with init)\n", "scara_jacobian_step", 1e9*(bench_now()-start)/max(n_steps,1));
+
+  // Status report position along the grid rows, a few steps apart per call.
+  int32_t steps[N_AXIS];
+  start = bench_now();
+  for (n=0; n<n_reachable; n++) {
+    uint8_t idx;
+    for (idx=0; idx<N_AXIS; idx++) { steps[idx] = lroundf(joint[n][idx]*settings.steps_per_mm[idx]); }
+    scara_report_position(cartesian, steps);
+    sink += cartesian[X_AXIS];
+  }
+  printf("  %-28s %8.1f ns\n", "scara_report_position", 1e9*(bench_now()-start)/n_reachable);
+  (void)sink;
+
+  free(batch);
+  free(joint);
+  free(point);
+  if (!(step_error.max <= max_error)) {
+    printf("FAIL: round trip error %.6f mm exceeds %.6f mm\n", step_error.max, max_error);
+    return(1);
+  }
+  if (n_failed > 0) {
+    printf("FAIL: %lu reachable points failed to solve\n", (unsigned long)n_failed);
+    return(1);
+  }
+  printf("PASS: round trip error within %.6f mm\n", max_error);
+  return(0);
+}
@@ -238,6 +238,8 @@
 // ADVANCED CONFIGURATION OPTIONS:
 
 // Enables code for debugging purposes. Not for general use and always in constant flux.
+// On the STM32, the debug report returns the worst stepper interrupt latency and execution time
+// in CPU cycles since the last report, as {ISR:latency,cycles}.
 // #define DEBUG // Uncomment to enable. Default disabled.
 
 // Configure rapid, feed, and spindle override settings. These values define the max and min
@@ -299,7 +301,45 @@
 // NOTE: Changing this value also changes the execution time of a segment in the step segment buffer.
 // When increasing this value, this stores less overall time in the segment buffer and vice versa. Make
 // certain the step segment buffer is increased/decreased to account for these changes.
-#define ACCELERATION_TICKS_PER_SECOND 100
+// NOTE: This sets the segment time of acceleration and deceleration ramps only. See below.
+#define ACCELERATION_TICKS_PER_SECOND 200
+
+// Segments are cut finely only where the speed changes. While cruising at constant speed, a segment
+// lasts up to 1/CRUISE_TICKS_PER_SECOND, which saves segment prep CPU time. Segments are shortened
+// as needed to keep their step count in range. The segment prep CPU load is reported by $I.
+// NOTE: Cruising segments store more time in the segment buffer, so a feed hold or an override
+// starting at cruise takes up to SEGMENT_BUFFER_SIZE-1 of them to take effect. Set this equal to
+// ACCELERATION_TICKS_PER_SECOND for a fixed segment time.
+#define CRUISE_TICKS_PER_SECOND 50
+
+// Shapes the acceleration ramps of the segment generator as jerk-limited S-curves, instead of the
+// constant acceleration ramps of the trapezoidal planner profiles. The acceleration rises and falls
+// at the axis jerk limits, settings $140-$142 in mm/sec^3, so the force on the machine does not step
+// and excite light, flexible machines like a SCARA arm. Each ramp covers the same distance in the
+// same time as the trapezoidal one, so feed holds, overrides and the planner stop where they did.
+// A ramp runs on through consecutive blocks that keep accelerating or decelerating, so the short
+// segments of arcs and SCARA lines share one S-curve. See stepper.c for details.
+// NOTE: The acceleration settings become the mean acceleration of a ramp. The peak rises up to twice
+// that, the shorter the ramp is for the jerk limit, so lower them if the motors run out of torque. An
+// axis jerk of zero does not limit the jerk. A replan that changes the profile of the executing block,
+// like a feed hold or an override, starts a new ramp from zero acceleration.
+// #define S_CURVE_ACCELERATION // Default disabled. Uncomment to enable.
+
+// Input shaping of the step segments, to cancel the ringing of a resonance, like that of an arm,
+// after every change of speed. The speed along the path is spread over two (ZV) or three (ZVD)
+// impulses, half a period of the resonance apart, so the ringing of the first is cancelled by the
+// others. Set the shaper type with $36 (0 off, 1 ZV, 2 ZVD), the resonance frequency with $37 in Hz,
+// and its damping ratio with $38. Only the times of the segments change, not the path or the steps,
+// so there is no loss of accuracy. Since the speed along the path is shaped, this cancels the
+// ringing of speeding up and slowing down, including the slow down at sharp corners, but not that
+// of a change of direction taken at speed, which is set by the junction deviation $11.
+// NOTE: The motion lags the planned motion by up to the shaper duration, half the resonance period
+// for ZV and a full period for ZVD. Ramps are longer by that, and feed holds stop that much later.
+// The duration is limited by SHAPER_BUFFER_SIZE (stepper.h). With 48, the lowest frequency is about
+// 4 Hz for ZV and 8 Hz for ZVD. Blocks much shorter than a segment fill the buffer sooner, which
+// blurs the shaping. ZVD is less sensitive to a frequency that is off. See stepper.c.
+// #define INPUT_SHAPING // Default disabled. Uncomment to enable.
+// #define SHAPER_BUFFER_SIZE 48 // Segments held by the shaper. Uncomment to override default in stepper.h.
 
 // Adaptive Multi-Axis Step Smoothing (AMASS) is an advanced feature that does what its name implies,
 // smoothing the stepping of multi-axis motions. This feature smooths motion particularly at low step
@@ -308,11 +348,35 @@
 // step smoothing. See stepper.c for more details on the AMASS system works.
 #define ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING  // Default enabled. Comment to disable.
 
+// Drives the step and direction pins by DMA, on the STM32F103C8, instead of interrupting twice per
+// step. Steps are rendered a buffer half at a time into GPIO BSRR words, which TIM4 clocks out to
+// the step port at STEP_DMA_FREQUENCY. This frees the CPU at high step rates, but quantizes the step
+// edges to the DMA period (5usec at 200kHz) and rounds the step pulse up to whole periods. Steps
+// are spaced at least one pulse plus one period apart, which caps the step rate (66kHz with the
+// default 10usec pulse). See stepper.c for details.
+// NOTE: The reported machine position leads the motors by up to two buffer halves, 2msec by
+// default. Homing and probing cycles fall back to the stepper interrupt, so a switch still stops
+// them on the exact step. Requires AMASS. Uses TIM4 and DMA1 channel 7.
+// #define STEP_DMA_BSRR // Default disabled. Uncomment to enable.
+#define STEP_DMA_FREQUENCY 200000 // Hz. Rate of BSRR writes.
+#define STEP_DMA_HALF_BUFFER 200 // BSRR words per half buffer, 1msec at 200kHz. Buffer uses 1.6KB of RAM.
+
+// Times the steps of each axis on its own TIM2 output compare channel, on the STM32F103C8, instead of
+// on the Bresenham ticks of the stepper interrupt. Each axis steps at even intervals of its own rate,
+// so the non-dominant axes, like a SCARA joint running slower than the other, step without aliasing,
+// and the compare hardware drives the step pins to the CPU cycle. The step counts are those of the
+// Bresenham algorithm, so positions stay exact. Costs two interrupts per step per axis, so the step
+// rate ceiling reported by $I is lower than on the stepper interrupt. See stepper.c for details.
+// NOTE: Requires the step pins on PA0-PA2, the TIM2 channel 1-3 outputs. Homing and probing cycles
+// fall back to the stepper interrupt. Not compatible with STEP_DMA_BSRR.
+// #define STEP_PER_AXIS_TIMING // Default disabled. Uncomment to enable.
+
 // Sets the maximum step rate allowed to be written as a Grbl setting. This option enables an error
 // check in the settings module to prevent settings values that will exceed this limitation. The maximum
 // step rate is strictly limited by the CPU speed and will change if something other than an AVR running
 // at 16MHz is used.
-// NOTE: For now disabled, will enable if flash space permits.
+// NOTE: For now disabled, will enable if flash space permits. On the STM32, the $I [STEP:] line
+// reports the ceiling of the running board, to pick this value from.
 // #define MAX_STEP_RATE_HZ 30000 // Hz
 
 // By default, Grbl sets all input pins to normal-high operation with their internal pull-up resistors
@@ -411,6 +475,56 @@
 // much greater than this. The default setting should capture most, if not all, full arc error situations.
 #define ARC_ANGULAR_TRAVEL_EPSILON 5E-7 // Float (radians)
 
+// SCARA kinematics only. Straight Cartesian lines are split by mc_line() into short segments, so the
+// joint interpolated motion between segment end points stays within the chordal tolerance ($41) of
+// the programmed path. The segment count is the larger of the time-based ($40) and chordal counts,
+// but a segment is never made shorter than this length, which bounds the planner and IK load of
+// very slow or very short moves. Increase if the planner buffer starves on dense g-code.
+#define SCARA_MIN_SEGMENT_LENGTH 0.1f // Float (mm)
+
+// SCARA kinematics only. Segment joint angles of a split line are advanced incrementally through the
+// inverse Jacobian, with an exact inverse kinematics solve every N_SCARA_CORRECTION segments, in the
+// same way as N_ARC_CORRECTION for arcs. The incremental update uses a midpoint step, so its path
+// drift grows with N and roughly the cube of the segment length. Worst-case drift from the exact
+// path between corrections, simulated over random lines across the reach of the default 200/200mm arm
+// with N=8: 0.6um at 0.1mm segments, 1.4um at 0.5mm, 9.4um at 1mm, and 67um at 2mm segments.
+// Segments longer than SCARA_JACOBIAN_MAX_SEGMENT are therefore always solved exactly. Decrease either
+// value if the drift is too large for the machine, or increase them to save more CPU time.
+#define N_SCARA_CORRECTION 8 // Integer (1-255)
+#define SCARA_JACOBIAN_MAX_SEGMENT 1.0f // Float (mm)
+
+// SCARA kinematics only. Replaces the soft-float sqrtf() and atan2f() inverse kinematics with a Q-format
+// fixed-point kernel using interpolated atan and sqrt lookup tables, for the FPU-less Cortex-M3. When
+// enabled, the [IK:] line of $I reports the measured CPU cycles per call of both kernels, so check it
+// on the board for the speedup. Worst-case joint angle error is ~1.2e-5 rad, well below one motor
+// step. See scara.c for the error figures.
+// #define SCARA_FIXED_POINT_IK // Default disabled. Uncomment to enable.
+
+// SCARA kinematics only. Plans rapid motions (G0) as a single block in joint space, from the current
+// joint pose to the inverse kinematics of the target, instead of a segmented straight line. Each
+// joint moves at its own max rate, so rapids take one planner block and the least time. The tool
+// path of a rapid is then a curve, not a line. Reachability and joint limits are still checked.
+#define SCARA_JOINT_RAPIDS // Default enabled. Comment to disable.
+
+// SCARA kinematic calibration ($K). Number of measured points held in RAM for the least-squares fit of
+// the arm lengths, tower offset and joint zero offsets. Each point costs 16 bytes. The fit needs at
+// least SCARA_CALIBRATION_MIN_POINTS, spread over the workspace with both joints well exercised.
+#define N_SCARA_CALIBRATION_POINTS 16 // Integer (4-255)
+#define SCARA_CALIBRATION_MIN_POINTS 4 // Integer (4-N_SCARA_CALIBRATION_POINTS)
+
+// Enables teach and replay ($T). While recording, every planned block is written to a flash region
+// with its motor steps, rates and junction speed, along with spindle, coolant and dwell commands. A
+// replay pushes the stored blocks straight into the planner, with no g-code parsing or kinematics.
+// The region sits in the upper 64KB of the STM32F103C8 flash, which the linker script leaves unused,
+// below the EEPROM emulation page. Each record takes 56 bytes, so the default 28KB hold 511 blocks.
+// NOTE: Flash programming stalls instruction fetch, and with it the stepper interrupt, for ~50us per
+// halfword written, ~1.4ms per block. So a recording moves nothing. Blocks are planned and written,
+// then discarded, like check mode, and spindle, coolant and dwell commands are not executed. Replay
+// only reads the flash and runs at full speed.
+// #define TEACH_AND_REPLAY // Default disabled. Uncomment to enable.
+#define TEACH_FLASH_START 0x08018000 // Flash page aligned address
+#define TEACH_FLASH_PAGES 28 // Integer (1KB pages). Must end below the EEPROM page at 0x0801FC00.
+
 // Time delay increments performed during a dwell. The default value is set at 50ms, which provides
 // a maximum time delay of roughly 55 minutes, more than enough for most any application. Increasing
 // this delay will increase the maximum dwell time linearly, but also reduces the responsiveness of
@@ -438,10 +552,11 @@
 
 // Governs the size of the intermediary step segment buffer between the step execution algorithm
 // and the planner blocks. Each segment is set of steps executed at a constant velocity over a
-// fixed time defined by ACCELERATION_TICKS_PER_SECOND. They are computed such that the planner
-// block velocity profile is traced exactly. The size of this buffer governs how much step
-// execution lead time there is for other Grbl processes have to compute and do their thing
-// before having to come back and refill this buffer, currently at ~50msec of step moves.
+// time defined by ACCELERATION_TICKS_PER_SECOND, or CRUISE_TICKS_PER_SECOND while cruising. They
+// are computed such that the planner block velocity profile is traced exactly. The size of this
+// buffer governs how much step execution lead time there is for other Grbl processes have to
+// compute and do their thing before having to come back and refill this buffer, currently at
+// ~50msec of step moves during ramps.
 // #define SEGMENT_BUFFER_SIZE 6 // Uncomment to override default in stepper.h.
 
 // Line buffer size from the serial input stream to be executed. Also, governs the size of
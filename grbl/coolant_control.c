@@ -193,6 +193,9 @@ void coolant_set_state(uint8_t mode)
 void coolant_sync(uint8_t mode)
 {
   if (sys.state == STATE_CHECK_MODE) { return; }
+  #ifdef TEACH_AND_REPLAY
+    if (teach_record_command(TEACH_RECORD_COOLANT, mode, 0.0f)) { return; }
+  #endif
   protocol_buffer_synchronize(); // Ensure coolant turns on when specified in program.
   coolant_set_state(mode);
 }
@@ -41,6 +41,12 @@
 #define DEFAULT_X_MAX_TRAVEL 200.0f // mm NOTE: Must be a positive value.
 #define DEFAULT_Y_MAX_TRAVEL 200.0f // mm NOTE: Must be a positive value.
 #define DEFAULT_Z_MAX_TRAVEL 200.0f // mm NOTE: Must be a positive value.
+#define DEFAULT_X_JERK (1000.0f*60*60*60) // 1000*60*60*60 mm/min^3 = 1000 mm/sec^3
+#define DEFAULT_Y_JERK (1000.0f*60*60*60) // 1000*60*60*60 mm/min^3 = 1000 mm/sec^3
+#define DEFAULT_Z_JERK (1000.0f*60*60*60) // 1000*60*60*60 mm/min^3 = 1000 mm/sec^3
+#define DEFAULT_SHAPER_TYPE 0 // Off
+#define DEFAULT_SHAPER_FREQUENCY 40.0f // Hz
+#define DEFAULT_SHAPER_DAMPING 0.1f
 #define DEFAULT_SPINDLE_RPM_MAX 2000.0f // rpm
 #define DEFAULT_SPINDLE_RPM_MIN 1.0f // rpm
 #define DEFAULT_PEN_TOP  115
@@ -65,6 +71,25 @@
 #define DEFAULT_HOMING_SEEK_RATE 1000.0f // mm/min
 #define DEFAULT_HOMING_DEBOUNCE_DELAY 200 // msec (0-65k)
 #define DEFAULT_HOMING_PULLOFF 5.0f // mm
+#define DEFAULT_SCARA_SEGMENTS_PER_SECOND 100.0f // segments/sec (0 disables)
+#define DEFAULT_SCARA_CHORDAL_TOLERANCE 0.01f // mm
+#define DEFAULT_SCARA_LINKAGE_1 200.0f // mm. Measure arm lengths precisely.
+#define DEFAULT_SCARA_LINKAGE_2 200.0f // mm
+#define DEFAULT_SCARA_OFFSET_X -135.0f // mm
+#define DEFAULT_SCARA_OFFSET_Y 105.0f // mm
+#define DEFAULT_SCARA_HOME_POS_X -45.43f // deg
+#define DEFAULT_SCARA_HOME_POS_Y 95.67f // deg
+#define DEFAULT_SCARA_HOME_POS_Z 0.0f // mm
+#define DEFAULT_SCARA_X_JOINT_MIN -360.0f // deg
+#define DEFAULT_SCARA_X_JOINT_MAX 360.0f // deg
+#define DEFAULT_SCARA_Y_JOINT_MIN -360.0f // deg
+#define DEFAULT_SCARA_Y_JOINT_MAX 360.0f // deg
+#define DEFAULT_SCARA_ELBOW 0 // 0=Right-handed, 1=Left-handed, 2=Auto
+#define DEFAULT_SCARA_X_JOINT_OFFSET 0.0f // deg
+#define DEFAULT_SCARA_Y_JOINT_OFFSET 0.0f // deg
+#define DEFAULT_SCARA_TOOL_OFFSET_X 0.0f // mm. Along the outer arm.
+#define DEFAULT_SCARA_TOOL_OFFSET_Y 0.0f // mm. Left of the outer arm.
+#define DEFAULT_SCARA_TOOL_WRIST 0.0f // deg
 
 #endif
 
@@ -70,10 +70,13 @@ typedef int bool;
 #include "spindle_control.h"
 #include "stepper.h"
 #include "jog.h"
+#include "teach.h"
 
 #ifdef SCARA
 #include "scara.h"
+#include "scara_calibration.h"
 #endif
+#include "kinematics.h"
 // ---------------------------------------------------------------------------------------
 // COMPILE-TIME ERROR CHECKING OF DEFINE VALUES:
 
@@ -101,6 +104,31 @@ typedef int bool;
 	#endif
 #endif
 
+#if defined(TEACH_AND_REPLAY) && !defined(STM32F103C8)
+  #error "TEACH_AND_REPLAY is only supported on the STM32F103C8."
+#endif
+
+#if defined(STEP_DMA_BSRR)
+  #if !defined(STM32F103C8)
+    #error "STEP_DMA_BSRR is only supported on the STM32F103C8."
+  #endif
+  #if !defined(ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING)
+    #error "STEP_DMA_BSRR requires ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING."
+  #endif
+#endif
+
+#if defined(STEP_PER_AXIS_TIMING)
+  #if !defined(STM32F103C8)
+    #error "STEP_PER_AXIS_TIMING is only supported on the STM32F103C8."
+  #endif
+  #if defined(STEP_DMA_BSRR)
+    #error "STEP_PER_AXIS_TIMING and STEP_DMA_BSRR both drive the step pins. Enable only one."
+  #endif
+  #if (X_STEP_BIT != 0) || (Y_STEP_BIT != 1) || (Z_STEP_BIT != 2) || (N_AXIS != 3)
+    #error "STEP_PER_AXIS_TIMING requires the X, Y and Z step pins on PA0-PA2, the TIM2 channel 1-3 outputs."
+  #endif
+#endif
+
 #if defined(SPINDLE_PWM_MIN_VALUE)
   #if !(SPINDLE_PWM_MIN_VALUE > 0)
     #error "SPINDLE_PWM_MIN_VALUE must be greater than zero."
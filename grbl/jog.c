@@ -21,6 +21,19 @@ along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
 #include "grbl.h"
 
 
+// Starts a planned jog motion, if idle. Further jogs are queued behind it while in the jog state.
+static void jog_start()
+{
+  if (sys.state == STATE_IDLE) {
+    if (plan_get_current_block() != NULL) { // Check if there is a block to execute.
+      sys.state = STATE_JOG;
+      st_prep_buffer();
+      st_wake_up();  // NOTE: Manual start. No state machine required.
+    }
+  }
+}
+
+
 // Sets up valid jog motion received from g-code parser, checks for soft-limits, and executes the jog.
 uint8_t jog_execute(plan_line_data_t *pl_data, parser_block_t *gc_block)
 {
@@ -32,19 +45,85 @@ uint8_t jog_execute(plan_line_data_t *pl_data, parser_block_t *gc_block)
   pl_data->line_number = gc_block->values.n;
 #endif
 
+  // Targets the machine can not reach are rejected, soft limits or not.
+  if (kinematics_check_travel_limits(gc_block->values.xyz)) { return(STATUS_TRAVEL_EXCEEDED); }
   if (bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE)) {
-    if (system_check_travel_limits(gc_block->values.xyz)) { return(STATUS_TRAVEL_EXCEEDED); }
+    if (system_check_linear_travel_limits(gc_block->values.xyz)) { return(STATUS_TRAVEL_EXCEEDED); }
   }
+  if (sys.state == STATE_CHECK_MODE) { return(STATUS_OK); }
 
-  // Valid jog command. Plan, set state, and execute.
-  mc_line(gc_block->values.xyz, pl_data);
-  if (sys.state == STATE_IDLE) {
-    if (plan_get_current_block() != NULL) { // Check if there is a block to execute.
-      sys.state = STATE_JOG;
-      st_prep_buffer();
-      st_wake_up();  // NOTE: Manual start. No state machine required.
+  // Valid jog command. Plan, set state, and execute. Planned past mc_line(), which would raise an
+  // alarm for a jog leaving the workspace midway, rather than stop it at the edge.
+  uint8_t status = kinematics_segment_line(gc_block->values.xyz, pl_data, true);
+  // A jog stopped at the workspace edge ends short of its target. The parser only takes the target
+  // upon STATUS_OK, so it continues from where the planner ends instead.
+  if (status != STATUS_OK) { plan_get_planner_mpos(gc_state.position); }
+  jog_start();
+  return(status);
+}
+
+
+#ifdef IS_SCARA
+uint8_t jog_joint_execute_line(char *line)
+{
+  float value[N_AXIS];
+  float feed_rate = 0.0f;
+  uint8_t distance = gc_state.modal.distance;
+  uint8_t words = 0; // Axis words in bits X_AXIS to Z_AXIS, and the F word in bit N_AXIS.
+  uint8_t char_counter = 4; // Start parsing after `$JJ=`
+  uint8_t idx;
+  while (line[char_counter] != 0) {
+    char letter = line[char_counter++];
+    float number;
+    if (!read_float(line, &char_counter, &number)) { return(STATUS_BAD_NUMBER_FORMAT); }
+    switch (letter) {
+      case 'G':
+        if (number == 90.0f) { distance = DISTANCE_MODE_ABSOLUTE; }
+        else if (number == 91.0f) { distance = DISTANCE_MODE_INCREMENTAL; }
+        else { return(STATUS_INVALID_JOG_COMMAND); }
+        break;
+      case 'F': case 'X': case 'Y': case 'Z':
+        idx = (letter == 'F' ? N_AXIS : letter-'X');
+        if (words & bit(idx)) { return(STATUS_GCODE_WORD_REPEATED); }
+        words |= bit(idx);
+        if (idx == N_AXIS) { feed_rate = number; }
+        else { value[idx] = number; }
+        break;
+      default: return(STATUS_INVALID_JOG_COMMAND);
+    }
+  }
+  if (bit_isfalse(words, bit(N_AXIS))) { return(STATUS_GCODE_UNDEFINED_FEED_RATE); }
+  if (feed_rate < 0.0f) { return(STATUS_NEGATIVE_VALUE); }
+  if (!(words & (bit(N_AXIS)-1))) { return(STATUS_GCODE_NO_AXIS_WORDS); }
+
+  // Incremental jogs, and axes without a word, continue from the end of the last planned block.
+  float target[N_AXIS];
+  plan_get_planner_joint_position(target);
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (words & bit(idx)) {
+      if (distance == DISTANCE_MODE_ABSOLUTE) { target[idx] = value[idx]; }
+      else { target[idx] += value[idx]; }
     }
   }
 
+  if (bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE)) {
+    if (scara_check_workspace(NULL, target) || system_check_linear_travel_limits(target)) {
+      return(STATUS_TRAVEL_EXCEEDED);
+    }
+  }
+
+  // Same planner data as a $J= jog. See gc_execute_line().
+  plan_line_data_t plan_data;
+  memset(&plan_data, 0, sizeof(plan_line_data_t));
+  plan_data.feed_rate = feed_rate;
+  plan_data.spindle_speed = gc_state.spindle_speed;
+  plan_data.condition = (gc_state.modal.spindle | gc_state.modal.coolant | PL_COND_FLAG_NO_FEED_OVERRIDE);
+  #ifdef USE_LINE_NUMBERS
+    plan_data.line_number = JOG_LINE_NUMBER;
+  #endif
+  mc_joint_line(target, &plan_data);
+  plan_get_planner_mpos(gc_state.position); // Sequential $J= jogs continue from the joint jog target.
+  jog_start();
   return(STATUS_OK);
 }
+#endif
@@ -29,4 +29,14 @@
 // Sets up valid jog motion received from g-code parser, checks for soft-limits, and executes the jog.
 uint8_t jog_execute(plan_line_data_t *pl_data, parser_block_t *gc_block);
 
+#ifdef SCARA
+  // Parses and executes a $JJ= joint jog, such as $JJ=G91X-5F300. X and Y are the inner and outer
+  // arm motor angles in degrees, and Z is in mm. F is the rate in degrees (or mm) per minute along the
+  // joint space move. G90 and G91 set the distance mode for this jog, which otherwise follows the
+  // parser. Absolute targets are motor angles and Z machine position, without any work offsets.
+  // Planned as one joint space block, without kinematics or segmentation. With soft limits enabled,
+  // the joint limits $50-$53 and Z max travel are checked as for $J= jogs.
+  uint8_t jog_joint_execute_line(char *line);
+#endif
+
 #endif
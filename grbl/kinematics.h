@@ -0,0 +1,246 @@
+/*
+  kinematics.h - Compile-time bound machine kinematics
+  Part of Grbl
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef kinematics_h
+#define kinematics_h
+
+// Machine kinematics. The conversions between machine positions and motor steps, the homing axis
+// handling and the machine specific travel limits live here, so the planner, homing and reporting
+// code does not branch on the machine type. One model is bound at compile time: SCARA (set in the
+// Makefile), COREXY (config.h) or Cartesian. The functions are static inline, since the planner and
+// status reports call them for every block and report.
+//
+// Three step frames are used. Motor steps, sys_position[], are counted by the stepper ISR and read
+// mid-motion through st_get_position(). Axis steps, pl.position[], are the planner position. They
+// differ only for CoreXY, where the X and Y axis steps are mixed onto the A and B motors. For SCARA,
+// the X and Y axis steps are joint steps and the machine position is found by forward kinematics.
+//
+// Line motions take two kinematic steps. mc_line() hands the line to kinematics_segment_line(), which
+// queues it in the planner blocks the machine needs. plan_buffer_line() maps each block end point to
+// axis coordinates by kinematics_inverse(). Cartesian and CoreXY machines queue the line as one block
+// and plan it in machine coordinates. SCARA arms split the line in motion_control.c, so the tool tip
+// follows it, and are planned in joint space by planner.c.
+
+#ifdef SCARA
+  #define KINEMATICS_FIRST_LINEAR_AXIS Z_AXIS // X and Y are the arm joints. Z is a linear axis.
+#else
+  #define KINEMATICS_FIRST_LINEAR_AXIS X_AXIS
+#endif
+
+
+#ifdef COREXY
+  // Returns x or y-axis "steps" based on CoreXY motor steps.
+  static inline int32_t kinematics_corexy_x_axis_steps(int32_t *steps)
+  {
+    return( (steps[A_MOTOR] + steps[B_MOTOR])/2 );
+  }
+  static inline int32_t kinematics_corexy_y_axis_steps(int32_t *steps)
+  {
+    return( (steps[A_MOTOR] - steps[B_MOTOR])/2 );
+  }
+#endif
+
+
+// Inverse kinematics. Returns the axis position to plan a line to machine position target[N_AXIS]
+// in, in mm. For SCARA, these are the joint angles in degrees, on the turns nearest the planner
+// position. The arrays must not alias.
+static inline void kinematics_inverse(float *axis_target, float *target)
+{
+  #ifdef SCARA
+    plan_get_planner_joint_position(axis_target);
+    inverse_kinematics(target, axis_target, axis_target);
+  #else
+    memcpy(axis_target, target, N_AXIS*sizeof(float));
+  #endif
+}
+
+
+// Queues a line motion to target[N_AXIS] in machine coordinates, split into as many planner blocks
+// as the machine needs to follow it. Called by mc_line() and jog_execute() once the target is
+// checked. Returns STATUS_TRAVEL_EXCEEDED, if the line leaves the reachable workspace midway. Jogs
+// then stop at its edge. Other lines raise a soft limit alarm.
+static inline uint8_t kinematics_segment_line(float *target, plan_line_data_t *pl_data, uint8_t is_jog)
+{
+  #ifdef SCARA
+    return(mc_scara_line(target, pl_data, is_jog));
+  #else
+    mc_buffer_line(target, pl_data);
+    return(STATUS_OK);
+  #endif
+}
+
+
+// Queues an arc motion, if the machine segments arcs its own way. Returns false to have mc_arc()
+// split it into lines. The arguments are those of mc_arc(), with the travel angle it computed.
+static inline uint8_t kinematics_segment_arc(float *target, plan_line_data_t *pl_data, float *position,
+  float *offset, float radius, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, float angular_travel)
+{
+  #ifdef SCARA
+    mc_scara_arc(target, pl_data, position, offset, radius, axis_0, axis_1, axis_linear, angular_travel);
+    return(true);
+  #else
+    return(false);
+  #endif
+}
+
+
+// Converts motor steps to axis steps. The arrays must not alias.
+static inline void kinematics_motor_to_axis_steps(int32_t *axis_steps, int32_t *motor_steps)
+{
+  memcpy(axis_steps, motor_steps, N_AXIS*sizeof(int32_t));
+  #ifdef COREXY
+    axis_steps[X_AXIS] = kinematics_corexy_x_axis_steps(motor_steps);
+    axis_steps[Y_AXIS] = kinematics_corexy_y_axis_steps(motor_steps);
+  #endif
+}
+
+
+// Converts a move in axis steps to the signed motor steps, in place.
+static inline void kinematics_axis_to_motor_steps(int32_t *steps)
+{
+  #ifdef COREXY
+    int32_t x_steps = steps[X_AXIS];
+    steps[A_MOTOR] = x_steps + steps[Y_AXIS];
+    steps[B_MOTOR] = x_steps - steps[Y_AXIS];
+  #endif
+}
+
+
+// Sets axis 'idx' of the motor steps to an axis step position, keeping the other axes where they are.
+// Used by homing to set the machine position of the homed axes.
+static inline void kinematics_set_axis_steps(int32_t *motor_steps, uint8_t idx, int32_t axis_steps)
+{
+  #ifdef COREXY
+    if (idx == X_AXIS) {
+      int32_t off_axis_steps = kinematics_corexy_y_axis_steps(motor_steps);
+      motor_steps[A_MOTOR] = axis_steps + off_axis_steps;
+      motor_steps[B_MOTOR] = axis_steps - off_axis_steps;
+      return;
+    } else if (idx == Y_AXIS) {
+      int32_t off_axis_steps = kinematics_corexy_x_axis_steps(motor_steps);
+      motor_steps[A_MOTOR] = off_axis_steps + axis_steps;
+      motor_steps[B_MOTOR] = off_axis_steps - axis_steps;
+      return;
+    }
+  #endif
+  motor_steps[idx] = axis_steps;
+}
+
+
+// Returns the step port pins that move axis 'idx'. Homing locks out an axis by these pins.
+static inline PORTPINDEF kinematics_axis_step_pins(uint8_t idx)
+{
+  #ifdef COREXY
+    if ((idx == X_AXIS) || (idx == Y_AXIS)) { return(step_pin_mask[A_MOTOR]|step_pin_mask[B_MOTOR]); }
+  #endif
+  return(step_pin_mask[idx]);
+}
+
+
+// Returns the position of axis 'idx' from motor steps, in mm. For the SCARA arm joints, this is the
+// motor angle in degrees.
+static inline float kinematics_axis_position(int32_t *motor_steps, uint8_t idx)
+{
+  #ifdef COREXY
+    if (idx == X_AXIS) { return((float)kinematics_corexy_x_axis_steps(motor_steps)/settings.steps_per_mm[idx]); }
+    if (idx == Y_AXIS) { return((float)kinematics_corexy_y_axis_steps(motor_steps)/settings.steps_per_mm[idx]); }
+  #endif
+  return(motor_steps[idx]/settings.steps_per_mm[idx]);
+}
+
+
+// Forward kinematics. Returns the machine position in mm from axis steps.
+static inline void kinematics_forward(float *position, int32_t *axis_steps)
+{
+  uint8_t idx;
+  #ifdef SCARA
+    float joint[N_AXIS];
+    for (idx=0; idx<N_AXIS; idx++) { joint[idx] = axis_steps[idx]/settings.steps_per_mm[idx]; }
+    forward_kinematics_SCARA(joint, position);
+  #else
+    for (idx=0; idx<N_AXIS; idx++) { position[idx] = axis_steps[idx]/settings.steps_per_mm[idx]; }
+  #endif
+}
+
+
+// Returns the machine position in mm from motor steps, for realtime status reports. Same as
+// system_convert_array_steps_to_mpos(), but SCARA reuses the last report's forward kinematics.
+static inline void kinematics_report_position(float *position, int32_t *motor_steps)
+{
+  #ifdef SCARA
+    scara_report_position(position, motor_steps);
+  #else
+    system_convert_array_steps_to_mpos(position, motor_steps);
+  #endif
+}
+
+
+// Plans a homing motion to target[N_AXIS] in axis coordinates. SCARA homes the joints directly, so
+// the target is in joint degrees and planned in joint space.
+static inline void kinematics_homing_line(float *target, plan_line_data_t *pl_data)
+{
+  #ifdef SCARA
+    plan_buffer_joint_line(target, NULL, pl_data);
+  #else
+    plan_buffer_line(target, pl_data);
+  #endif
+}
+
+
+// Called after each search and locate pass of a homing cycle.
+static inline void kinematics_homing_pass()
+{
+  #ifdef SCARA
+    scara_report_positions();
+  #endif
+}
+
+
+// Returns the axis step position of homed axis 'idx', at its switch after the pull-off motion.
+static inline int32_t kinematics_homing_position(uint8_t idx)
+{
+  #ifdef SCARA
+    return(lroundf((settings.scara_home_pos[idx]+settings.homing_pulloff)*settings.steps_per_mm[idx]));
+  #elif defined(HOMING_FORCE_SET_ORIGIN)
+    return(0);
+  #else
+    // NOTE: settings.max_travel[] is stored as a negative value.
+    if ( bit_istrue(settings.homing_dir_mask,bit(idx)) ) {
+      return(lroundf((settings.max_travel[idx]+settings.homing_pulloff)*settings.steps_per_mm[idx]));
+    }
+    return(lroundf(-settings.homing_pulloff*settings.steps_per_mm[idx]));
+  #endif
+}
+
+
+// Checks the travel limits of a target that do not follow from max travel, and returns true if it
+// is out of bounds. Axes from KINEMATICS_FIRST_LINEAR_AXIS up are checked against max travel by
+// system_check_travel_limits().
+static inline uint8_t kinematics_check_travel_limits(float *target)
+{
+  #ifdef SCARA
+    // XY travel of the arm is bounded by its reachable workspace and joint limits.
+    float target_joint[N_AXIS];
+    kinematics_inverse(target_joint, target);
+    return(scara_check_workspace(target, target_joint));
+  #else
+    return(false);
+  #endif
+}
+
+#endif
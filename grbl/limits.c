@@ -180,10 +180,7 @@ void limits_go_home(uint8_t cycle_mask)
   uint8_t idx;
   for (idx=0; idx<N_AXIS; idx++) {
     // Initialize step pin masks
-    step_pin[idx] = step_pin_mask[idx];
-    #ifdef COREXY
-      if ((idx==A_MOTOR)||(idx==B_MOTOR)) { step_pin[idx] = (step_pin_mask[X_AXIS]| step_pin_mask[Y_AXIS]); }
-    #endif
+    step_pin[idx] = kinematics_axis_step_pins(idx);
 
     if (bit_istrue(cycle_mask,bit(idx))) {
       // Set target based on max_travel setting. Ensure homing switches engaged with search scalar.
@@ -194,7 +191,6 @@ void limits_go_home(uint8_t cycle_mask)
 
   // Set search mode with approach at seek rate to quickly engage the specified cycle_mask limit switches.
   bool approach = true;
-  angle_mode = true;
 
   float homing_rate = settings.homing_seek_rate;
 
@@ -207,20 +203,7 @@ void limits_go_home(uint8_t cycle_mask)
       // Set target location for active axes and setup computation for homing rate.
       if (bit_istrue(cycle_mask,bit(idx))) {
         n_active_axis++;
-        #ifdef COREXY
-          if (idx == X_AXIS) {
-            int32_t axis_position = system_convert_corexy_to_y_axis_steps(sys_position);
-            sys_position[A_MOTOR] = axis_position;
-            sys_position[B_MOTOR] = -axis_position;
-          } else if (idx == Y_AXIS) {
-            int32_t axis_position = system_convert_corexy_to_x_axis_steps(sys_position);
-            sys_position[A_MOTOR] = sys_position[B_MOTOR] = axis_position;
-          } else {
-            sys_position[Z_AXIS] = 0;
-          }
-        #else
-          sys_position[idx] = 0;
-        #endif
+        kinematics_set_axis_steps(sys_position, idx, 0);
         // Set target direction based on cycle mask and homing cycle approach state.
         // NOTE: This happens to compile smaller than any other implementation tried.
         if (bit_istrue(settings.homing_dir_mask,bit(idx))) {
@@ -232,6 +215,8 @@ void limits_go_home(uint8_t cycle_mask)
         }
         // Apply axislock to the step port pins active in this cycle.
         axislock |= step_pin[idx];
+      } else {
+        target[idx] = kinematics_axis_position(sys_position, idx); // Other axes stay where they are.
       }
 
     }
@@ -240,7 +225,7 @@ void limits_go_home(uint8_t cycle_mask)
 
     // Perform homing cycle. Planner buffer should be empty, as required to initiate the homing cycle.
     pl_data->feed_rate = homing_rate; // Set current homing rate.
-    plan_buffer_line(target, pl_data); // Bypass mc_line(). Directly plan homing motion.
+    kinematics_homing_line(target, pl_data); // Bypass mc_line(). Directly plan homing motion.
 
     sys.step_control = STEP_CONTROL_EXECUTE_SYS_MOTION; // Set to execute homing motion and clear existing flags.
     st_prep_buffer(); // Prep and fill segment buffer from newly planned block.
@@ -252,12 +237,7 @@ void limits_go_home(uint8_t cycle_mask)
         for (idx=0; idx<N_AXIS; idx++) {
           if (axislock & step_pin[idx]) {
             if (limit_state & (1 << idx)) {
-              #ifdef COREXY
-                if (idx==Z_AXIS) { axislock &= ~(step_pin[Z_AXIS]); }
-                else { axislock &= ~(step_pin[A_MOTOR]|step_pin[B_MOTOR]); }
-              #else
-                axislock &= ~(step_pin[idx]);
-              #endif
+              axislock &= ~(step_pin[idx]);
             }
           }
         }
@@ -304,9 +284,7 @@ void limits_go_home(uint8_t cycle_mask)
       max_travel = settings.homing_pulloff;
       homing_rate = settings.homing_seek_rate;
     }
-#ifdef SCARA
-	scara_report_positions();
-#endif
+    kinematics_homing_pass();
   } while (n_cycle-- > 0);
 
   // The active cycle axes should now be homed and machine limits have been located. By
@@ -315,41 +293,9 @@ void limits_go_home(uint8_t cycle_mask)
   // set up pull-off maneuver from axes limit switches that have been homed. This provides
   // some initial clearance off the switches and should also help prevent them from falsely
   // triggering when hard limits are enabled or when more than one axes shares a limit pin.
-  int32_t set_axis_position;
   // Set machine positions for homed limit switches. Don't update non-homed axes.
   for (idx=0; idx<N_AXIS; idx++) {
-    // NOTE: settings.max_travel[] is stored as a negative value.
-    if (cycle_mask & bit(idx)) {
-      #ifdef IS_SCARA
-		set_axis_position = lroundf((ManualHomePos[idx]+settings.homing_pulloff)*settings.steps_per_mm[idx]);
-		angle_mode = false;
-	  #elif HOMING_FORCE_SET_ORIGIN
-    	set_axis_position = 0;
-      #else
-        if ( bit_istrue(settings.homing_dir_mask,bit(idx)) ) {
-          set_axis_position = lroundf((settings.max_travel[idx]+settings.homing_pulloff)*settings.steps_per_mm[idx]);
-        } else {
-          set_axis_position = lroundf(-settings.homing_pulloff*settings.steps_per_mm[idx]);
-        }
-      #endif
-
-      #ifdef COREXY
-        if (idx==X_AXIS) {
-          int32_t off_axis_position = system_convert_corexy_to_y_axis_steps(sys_position);
-          sys_position[A_MOTOR] = set_axis_position + off_axis_position;
-          sys_position[B_MOTOR] = set_axis_position - off_axis_position;
-        } else if (idx==Y_AXIS) {
-          int32_t off_axis_position = system_convert_corexy_to_x_axis_steps(sys_position);
-          sys_position[A_MOTOR] = off_axis_position + set_axis_position;
-          sys_position[B_MOTOR] = off_axis_position - set_axis_position;
-        } else {
-          sys_position[idx] = set_axis_position;
-        }
-	  #else
-        sys_position[idx] = set_axis_position;
-      #endif
-
-    }
+    if (cycle_mask & bit(idx)) { kinematics_set_axis_steps(sys_position, idx, kinematics_homing_position(idx)); }
   }
   sys.step_control = STEP_CONTROL_NORMAL_OP; // Return step control to normal operation.
 }
@@ -360,21 +306,26 @@ void limits_go_home(uint8_t cycle_mask)
 // NOTE: Used by jogging to limit travel within soft-limit volume.
 void limits_soft_check(float *target)
 {
-  if (system_check_travel_limits(target)) {
-    sys.soft_limit = true;
-    // Force feed hold if cycle is active. All buffered blocks are guaranteed to be within
-    // workspace volume so just come to a controlled stop so position is not lost. When complete
-    // enter alarm mode.
-    if (sys.state == STATE_CYCLE) {
-      system_set_exec_state_flag(EXEC_FEED_HOLD);
-      do {
-        protocol_execute_realtime();
-        if (sys.abort) { return; }
-      } while ( sys.state != STATE_IDLE );
-    }
-    mc_reset(); // Issue system reset and ensure spindle and coolant are shutdown.
-    system_set_exec_alarm(EXEC_ALARM_SOFT_LIMIT); // Indicate soft limit critical event
-    protocol_execute_realtime(); // Execute to enter critical event loop and system abort
-    return;
+  if (system_check_travel_limits(target)) { limits_soft_alarm(EXEC_ALARM_SOFT_LIMIT); }
+}
+
+
+// Halts motion upon a soft limit or SCARA workspace violation and enters the alarm state. The
+// offending motion is never planned.
+void limits_soft_alarm(uint8_t alarm)
+{
+  sys.soft_limit = true;
+  // Force feed hold if cycle is active. All buffered blocks are guaranteed to be within
+  // workspace volume so just come to a controlled stop so position is not lost. When complete
+  // enter alarm mode.
+  if (sys.state == STATE_CYCLE) {
+    system_set_exec_state_flag(EXEC_FEED_HOLD);
+    do {
+      protocol_execute_realtime();
+      if (sys.abort) { return; }
+    } while ( sys.state != STATE_IDLE );
   }
+  mc_reset(); // Issue system reset and ensure spindle and coolant are shutdown.
+  system_set_exec_alarm(alarm); // Indicate soft limit critical event
+  protocol_execute_realtime(); // Execute to enter critical event loop and system abort
 }
@@ -38,4 +38,7 @@ void limits_go_home(uint8_t cycle_mask);
 // Check for soft limit violations
 void limits_soft_check(float *target);
 
+// Stops motion and enters the given alarm upon a soft limit or workspace violation
+void limits_soft_alarm(uint8_t alarm);
+
 #endif
@@ -165,7 +165,13 @@ int main(void)
     coolant_init();
     limits_init();
     probe_init();
+    #ifdef IS_SCARA
+      scara_init(); // Cache kinematics constants. Needed by plan_sync_position().
+    #endif
     plan_reset(); // Clear block buffer and planner variables
+    #ifdef TEACH_AND_REPLAY
+      teach_reset(); // An unfinished recording is lost.
+    #endif
     st_reset(); // Clear stepper subsystem variables.
 
     // Sync cleared gcode and planner positions to current system position.
@@ -22,6 +22,212 @@
 #include "grbl.h"
 
 
+// Waits for room in the planner buffer and queues a single line motion. Called by mc_line() through
+// kinematics_segment_line(), and by the SCARA line segmentation, which may queue many planner blocks
+// for one programmed line.
+// NOTE: For SCARA machines, target[N_AXIS] is in joint space. Kinematics are solved by the caller,
+// which also passes the Cartesian end point the block is planned in. See plan_buffer_joint_line().
+#ifdef IS_SCARA
+void mc_buffer_line(float *target, float *cartesian, plan_line_data_t *pl_data)
+#else
+void mc_buffer_line(float *target, plan_line_data_t *pl_data)
+#endif
+{
+  // If the buffer is full: good! That means we are well ahead of the robot.
+  // Remain in this loop until there is room in the buffer.
+  do {
+    protocol_execute_realtime(); // Check for any run-time commands
+    if (sys.abort) { return; } // Bail, if system abort.
+    // NOTE: A jog cancel flushes the planner once the motion has stopped. Bail before then, so no
+    // motion of the cancelled jog gets queued after the flush.
+    if (sys.suspend & SUSPEND_JOG_CANCEL) { return; }
+    if ( plan_check_full_buffer() ) { protocol_auto_cycle_start(); } // Auto-cycle start when buffer is full.
+    else { break; }
+  } while (1);
+
+  // Plan and queue motion into planner buffer
+  #ifdef IS_SCARA
+    uint8_t plan_status = plan_buffer_joint_line(target, cartesian, pl_data);
+  #else
+    uint8_t plan_status = plan_buffer_line(target, pl_data);
+  #endif
+	if (plan_status == PLAN_EMPTY_BLOCK) {
+		if (bit_istrue(settings.flags, BITFLAG_LASER_MODE)) {
+			// Correctly set spindle state, if there is a coincident position passed. Forces a buffer
+			// sync while in M3 laser mode only.
+			if (pl_data->condition & PL_COND_FLAG_SPINDLE_CW) {
+				spindle_sync(PL_COND_FLAG_SPINDLE_CW, pl_data->spindle_speed);
+			}
+		}
+	}
+}
+
+
+#ifdef IS_SCARA
+// A line target or segment outside the reachable workspace. Lines halt in a soft limit alarm. Jogs
+// only stop queuing, so a jog that leaves the workspace midway runs up to its edge, and return an
+// error like a jog past the soft limits.
+static uint8_t mc_scara_out_of_workspace(uint8_t alarm, uint8_t is_jog)
+{
+  if (!is_jog) { limits_soft_alarm(alarm); }
+  return(STATUS_TRAVEL_EXCEEDED);
+}
+
+
+// Splits a Cartesian line into segments for the SCARA arm. The planner interpolates the joints
+// linearly between block end points, so the tool tip bows away from the straight path in between.
+// The segment count is the larger of the time-based count ($40 segments per second at the programmed
+// feed) and the count needed to keep this bow within the chordal tolerance ($41). The bow is estimated
+// once per line from the joint space midpoint, and shrinks with the square of the segment length.
+// NOTE: Rapids have no Cartesian rate to base the time split on, so only the chordal count applies.
+// Segment joint angles are advanced through the inverse Jacobian rather than solved from scratch,
+// with an exact inverse kinematics solve every N_SCARA_CORRECTION segments, like mc_arc().
+// Returns STATUS_TRAVEL_EXCEEDED, if the line leaves the workspace. See mc_scara_out_of_workspace().
+uint8_t mc_scara_line(float *target, plan_line_data_t *pl_data, uint8_t is_jog)
+{
+  float position[N_AXIS], delta[N_AXIS];
+  float joint_start[N_AXIS], joint_end[N_AXIS];
+  uint8_t idx;
+  plan_get_planner_mpos(position); // Line starts at the end point of the last planned block.
+  plan_get_planner_joint_position(joint_start);
+  for (idx=0; idx<N_AXIS; idx++) { delta[idx] = target[idx]-position[idx]; }
+  if ((settings.scara_elbow == SCARA_ELBOW_AUTO) && (pl_data->condition & PL_COND_FLAG_RAPID_MOTION)) {
+    scara_inverse_kinematics_shortest(target, joint_end, joint_start);
+  } else {
+    inverse_kinematics(target, joint_end, joint_start);
+  }
+
+  // Reject unreachable targets before anything is planned. Segments are checked as they go, since
+  // a straight line between two reachable points may still cut through the dead zone of the arm.
+  uint8_t alarm = scara_check_workspace(target, joint_end);
+  if (alarm) { return(mc_scara_out_of_workspace(alarm, is_jog)); }
+
+  #ifdef SCARA_JOINT_RAPIDS
+    // Rapids do not follow a path. Planned as a single joint move, which every joint runs at its max
+    // rate and never leaves the workspace, since each joint stays between its two reachable ends.
+    if (pl_data->condition & PL_COND_FLAG_RAPID_MOTION) {
+      mc_buffer_line(joint_end, NULL, pl_data);
+      return(STATUS_OK);
+    }
+  #endif
+
+  // A straight line never changes the elbow configuration, since the arm would have to pass through
+  // straight. Rapids that do are planned as a single joint move. Feeds and jogs are rejected, since
+  // the arm is not in the configured elbow configuration, after homing, a joint jog or a change of
+  // $54. The operator changes configuration with an explicit G0 or $JJ= joint jog.
+  if (scara_elbow(joint_end) != scara_elbow(joint_start)) {
+    if (pl_data->condition & PL_COND_FLAG_RAPID_MOTION) {
+      mc_buffer_line(joint_end, NULL, pl_data);
+      return(STATUS_OK);
+    }
+    return(mc_scara_out_of_workspace(EXEC_ALARM_WORKSPACE, is_jog));
+  }
+
+  // Only the XY plane is nonlinear. Z moves are passed through as a single block.
+  float xy_mm = hypot_f(delta[X_AXIS], delta[Y_AXIS]);
+  uint32_t segments = 1;
+
+  // Joint rates per mm of travel peak where the arm is closest to straight or folded. The Jacobian is
+  // tracked along the line to cap the feed of each segment at the worse of its two ends.
+  scara_jacobian_t jac;
+  float unit_vec[N_AXIS];
+  float rate_limit = 0.0f;
+  if (xy_mm > 0.0f) {
+    scara_jacobian_init(&jac, joint_start);
+    float inv_mm = 1.0f/sqrtf(xy_mm*xy_mm + delta[Z_AXIS]*delta[Z_AXIS]);
+    for (idx=0; idx<N_AXIS; idx++) { unit_vec[idx] = delta[idx]*inv_mm; }
+    rate_limit = scara_joint_rate_limit(&jac, unit_vec);
+  }
+
+  if (xy_mm > SCARA_MIN_SEGMENT_LENGTH) {
+    float n_segments = 0.0f;
+    if ((settings.scara_segments_per_second > 0.0f) && !(pl_data->condition & PL_COND_FLAG_RAPID_MOTION)) {
+      float minutes = 0.0f;
+      if (pl_data->condition & PL_COND_FLAG_INVERSE_TIME) { minutes = 1.0f/pl_data->feed_rate; }
+      else if (pl_data->feed_rate > 0.0f) {
+        minutes = sqrtf(xy_mm*xy_mm + delta[Z_AXIS]*delta[Z_AXIS])/pl_data->feed_rate;
+      }
+      n_segments = minutes*60.0f*settings.scara_segments_per_second;
+    }
+    if (settings.scara_chordal_tolerance > 0.0f) {
+      float joint_mid[N_AXIS], midpoint[N_AXIS];
+      for (idx=0; idx<N_AXIS; idx++) { joint_mid[idx] = 0.5f*(joint_start[idx]+joint_end[idx]); }
+      forward_kinematics_SCARA(joint_mid, midpoint);
+      float deviation = hypot_f(midpoint[X_AXIS]-(position[X_AXIS]+0.5f*delta[X_AXIS]),
+                                midpoint[Y_AXIS]-(position[Y_AXIS]+0.5f*delta[Y_AXIS]));
+      n_segments = max(n_segments, sqrtf(deviation/settings.scara_chordal_tolerance));
+    }
+    n_segments = min(n_segments, xy_mm/SCARA_MIN_SEGMENT_LENGTH);
+    if (n_segments > 1.0f) { segments = (uint32_t)ceilf(n_segments); }
+  }
+
+  float feed_rate = pl_data->feed_rate;
+  if (segments > 1) {
+    // Multiply inverse feed_rate to compensate for the fact that this movement is approximated
+    // by a number of discrete segments. The inverse feed_rate should be correct for the sum of
+    // all segments.
+    if (pl_data->condition & PL_COND_FLAG_INVERSE_TIME) { pl_data->feed_rate *= segments; }
+
+    float segment_delta[N_AXIS], segment[N_AXIS];
+    float inv_segments = 1.0f/segments;
+    for (idx=0; idx<N_AXIS; idx++) { segment_delta[idx] = delta[idx]*inv_segments; }
+
+    // Incremental joint updates drift with the cube of the segment length. Long segments are
+    // always solved exactly. See N_SCARA_CORRECTION in config.h for the drift bound.
+    uint8_t use_jacobian = (xy_mm*inv_segments <= SCARA_JACOBIAN_MAX_SEGMENT);
+    memcpy(segment, joint_start, sizeof(joint_start));
+
+    float cartesian[N_AXIS];
+    uint8_t count = 0;
+    uint32_t i;
+    for (i = 1; i<segments; i++) {
+      for (idx=0; idx<N_AXIS; idx++) { cartesian[idx] = position[idx] + i*segment_delta[idx]; }
+      if (use_jacobian && (count < N_SCARA_CORRECTION) && scara_jacobian_step(&jac, segment_delta, segment)) {
+        count++;
+      } else {
+        // Exact inverse kinematics solve. Resets the incremental update and its drift.
+        inverse_kinematics(cartesian, segment, segment);
+        scara_jacobian_init(&jac, segment);
+        count = 0;
+      }
+      alarm = scara_check_workspace(cartesian, segment);
+      if (alarm) {
+        pl_data->feed_rate = feed_rate;
+        pl_data->joint_rate_limit = 0.0f;
+        return(mc_scara_out_of_workspace(alarm, is_jog));
+      }
+      float end_rate_limit = scara_joint_rate_limit(&jac, unit_vec);
+      pl_data->joint_rate_limit = min(rate_limit, end_rate_limit);
+      rate_limit = end_rate_limit;
+      mc_buffer_line(segment, cartesian, pl_data);
+      // Bail mid-line on abort or jog cancel. Remaining segments must not be queued.
+      if (sys.abort || (sys.suspend & SUSPEND_JOG_CANCEL)) {
+        pl_data->feed_rate = feed_rate;
+        pl_data->joint_rate_limit = 0.0f;
+        return(STATUS_OK);
+      }
+    }
+    // Lines sweeping over half a turn of a joint end a turn off the start. Follow the segments.
+    scara_unwrap(joint_end, segment);
+    alarm = scara_check_workspace(NULL, joint_end);
+    if (alarm) {
+      pl_data->feed_rate = feed_rate;
+      pl_data->joint_rate_limit = 0.0f;
+      return(mc_scara_out_of_workspace(alarm, is_jog));
+    }
+  }
+  if (xy_mm > 0.0f) {
+    scara_jacobian_init(&jac, joint_end);
+    pl_data->joint_rate_limit = min(rate_limit, scara_joint_rate_limit(&jac, unit_vec));
+  }
+  mc_buffer_line(joint_end, target, pl_data); // Ensure last segment arrives at target location.
+  pl_data->feed_rate = feed_rate;
+  pl_data->joint_rate_limit = 0.0f;
+  return(STATUS_OK);
+}
+#endif
+
+
 // Execute linear motion in absolute millimeter coordinates. Feed rate given in millimeters/second
 // unless invert_feed_rate is true. Then the feed_rate means that the motion should be completed in
 // (1 minute)/feed_rate time.
@@ -55,26 +261,139 @@ void mc_line(float *target, plan_line_data_t *pl_data)
   // doesn't update the machine position values. Since the position values used by the g-code
   // parser and planner are separate from the system machine positions, this is doable.
 
-  // If the buffer is full: good! That means we are well ahead of the robot.
-  // Remain in this loop until there is room in the buffer.
-  do {
-    protocol_execute_realtime(); // Check for any run-time commands
-    if (sys.abort) { return; } // Bail, if system abort.
-    if ( plan_check_full_buffer() ) { protocol_auto_cycle_start(); } // Auto-cycle start when buffer is full.
-    else { break; }
-  } while (1);
+  kinematics_segment_line(target, pl_data, false);
+}
 
-  // Plan and queue motion into planner buffer
-	if (plan_buffer_line(target, pl_data) == PLAN_EMPTY_BLOCK) {
-		if (bit_istrue(settings.flags, BITFLAG_LASER_MODE)) {
-			// Correctly set spindle state, if there is a coincident position passed. Forces a buffer
-			// sync while in M3 laser mode only.
-			if (pl_data->condition & PL_COND_FLAG_SPINDLE_CW) {
-				spindle_sync(PL_COND_FLAG_SPINDLE_CW, pl_data->spindle_speed);
-			}
-		}
-	}
+
+#ifdef IS_SCARA
+void mc_joint_line(float *target, plan_line_data_t *pl_data)
+{
+  if (sys.state == STATE_CHECK_MODE) { return; }
+  mc_buffer_line(target, NULL, pl_data);
 }
+#endif
+
+
+#ifdef IS_SCARA
+#define SCARA_ARC_BATCH 8 // Arc points solved per inverse kinematics batch.
+// Largest arc angle per segment. Keeps the small angle rotation of mc_arc() accurate between corrections.
+#define SCARA_ARC_MAX_SEGMENT_ANGLE 0.25f // radians
+
+// SCARA arcs. Points are generated by the same vector rotation as mc_arc(), solved in batches and
+// planned directly as joint blocks, without a pass through mc_line() and the line segmentation.
+// Between two points the arm interpolates its joints, which bows the path away from the straight
+// chord, often towards the arc. So the segment count is set by the deviation of the joint path from
+// the arc against arc_tolerance, as measured on a few sample chords, instead of the chord sagitta.
+// Arcs about the tower axis are followed exactly and only need the rotation accuracy segments.
+void mc_scara_arc(float *target, plan_line_data_t *pl_data, float *position, float *offset,
+  float radius, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, float angular_travel)
+{
+  float center_axis0 = position[axis_0] + offset[axis_0];
+  float center_axis1 = position[axis_1] + offset[axis_1];
+  float linear_travel = target[axis_linear] - position[axis_linear];
+  float joint[N_AXIS];
+  uint8_t idx, j;
+
+  if (bit_istrue(settings.flags,BITFLAG_SOFT_LIMIT_ENABLE)) { limits_soft_check(target); }
+  if ((sys.state == STATE_CHECK_MODE) || sys.abort) { return; }
+
+  // Arcs run in the elbow configuration the arm is in. Rejected, if it is not the configured one.
+  // See mc_scara_line().
+  plan_get_planner_joint_position(joint);
+  if ((settings.scara_elbow != SCARA_ELBOW_AUTO) && (scara_elbow(joint) != settings.scara_elbow)) {
+    limits_soft_alarm(EXEC_ALARM_WORKSPACE);
+    return;
+  }
+
+  // Chord count holding the sagitta within arc_tolerance, as in mc_arc().
+  float n_chord = fabsf(0.5f*angular_travel*radius) /
+                  sqrtf(settings.arc_tolerance*(2*radius - settings.arc_tolerance));
+  n_chord = max(n_chord, 1.0f);
+
+  // Joint path deviation at that chord length, sampled at the start, end and two inner chords of the
+  // arc. Computed with exact trig, since it runs once per arc.
+  float sample[3][N_AXIS], joint_sample[3][N_AXIS]; // Chord start, end and arc midpoint.
+  float phi = angular_travel/n_chord;
+  float deviation = 0.0f;
+  uint8_t k;
+  for (k=0; k<4; k++) {
+    float chord_start = (angular_travel-phi)*k*(1.0f/3.0f);
+    for (j=0; j<3; j++) {
+      float angle = chord_start + phi*((j == 2) ? 0.5f : j);
+      float cos_a = cosf(angle);
+      float sin_a = sinf(angle);
+      sample[j][axis_0] = center_axis0 - offset[axis_0]*cos_a + offset[axis_1]*sin_a;
+      sample[j][axis_1] = center_axis1 - offset[axis_0]*sin_a - offset[axis_1]*cos_a;
+      sample[j][axis_linear] = position[axis_linear] + linear_travel*(angle/angular_travel);
+    }
+    inverse_kinematics_batch(sample, joint_sample, 2, joint);
+    for (idx=0; idx<N_AXIS; idx++) { joint_sample[2][idx] = 0.5f*(joint_sample[0][idx]+joint_sample[1][idx]); }
+    forward_kinematics_SCARA(joint_sample[2], sample[0]);
+    for (idx=0; idx<N_AXIS; idx++) { sample[0][idx] -= sample[2][idx]; }
+    deviation = max(deviation, convert_delta_vector_to_unit_vector(sample[0]));
+  }
+
+  // Deviation grows with the square of the segment length.
+  float n_segments = n_chord*sqrtf(deviation/settings.arc_tolerance);
+  n_segments = max(n_segments, fabsf(angular_travel)*(1.0f/SCARA_ARC_MAX_SEGMENT_ANGLE));
+  n_segments = min(n_segments, hypot_f(angular_travel*radius, linear_travel)/SCARA_MIN_SEGMENT_LENGTH);
+  uint16_t segments = 1;
+  if (n_segments > 1.0f) { segments = (uint16_t)ceilf(min(n_segments, 65535.0f)); }
+
+  // Inverse time feed rate is kept per segment, so the sum of all segments completes in time.
+  float feed_rate = pl_data->feed_rate;
+  if (pl_data->condition & PL_COND_FLAG_INVERSE_TIME) { pl_data->feed_rate *= segments; }
+
+  float theta_per_segment = angular_travel/segments;
+  float linear_per_segment = linear_travel/segments;
+  float cos_T = 2.0f - theta_per_segment*theta_per_segment;
+  float sin_T = theta_per_segment*0.16666667f*(cos_T + 4.0f);
+  cos_T *= 0.5f;
+  float r_axis0 = -offset[axis_0];
+  float r_axis1 = -offset[axis_1];
+  float r_axisi;
+
+  float batch[SCARA_ARC_BATCH][N_AXIS], joint_batch[SCARA_ARC_BATCH][N_AXIS];
+  uint8_t n = 0;
+  uint8_t count = 0;
+  uint32_t i; // Wider than segments, so the loop ends at 65535 segments.
+  for (i = 1; i<=segments; i++) {
+    if (i == segments) {
+      memcpy(batch[n], target, sizeof(batch[n])); // Ensure last segment arrives at target location.
+    } else {
+      if (count < N_ARC_CORRECTION) {
+        r_axisi = r_axis0*sin_T + r_axis1*cos_T;
+        r_axis0 = r_axis0*cos_T - r_axis1*sin_T;
+        r_axis1 = r_axisi;
+        count++;
+      } else {
+        float cos_Ti = cosf(i*theta_per_segment);
+        float sin_Ti = sinf(i*theta_per_segment);
+        r_axis0 = -offset[axis_0]*cos_Ti + offset[axis_1]*sin_Ti;
+        r_axis1 = -offset[axis_0]*sin_Ti - offset[axis_1]*cos_Ti;
+        count = 0;
+      }
+      batch[n][axis_0] = center_axis0 + r_axis0;
+      batch[n][axis_1] = center_axis1 + r_axis1;
+      batch[n][axis_linear] = position[axis_linear] + i*linear_per_segment;
+    }
+    n++;
+    if ((n < SCARA_ARC_BATCH) && (i < segments)) { continue; }
+
+    inverse_kinematics_batch(batch, joint_batch, n, joint);
+    for (j=0; j<n; j++) {
+      uint8_t alarm = scara_check_workspace(batch[j], joint_batch[j]);
+      if (alarm) { pl_data->feed_rate = feed_rate; limits_soft_alarm(alarm); return; }
+      mc_buffer_line(joint_batch[j], batch[j], pl_data);
+      // Bail mid-circle on abort or jog cancel. Remaining segments must not be queued.
+      if (sys.abort || (sys.suspend & SUSPEND_JOG_CANCEL)) { pl_data->feed_rate = feed_rate; return; }
+    }
+    memcpy(joint, joint_batch[n-1], sizeof(joint));
+    n = 0;
+  }
+  pl_data->feed_rate = feed_rate;
+}
+#endif
 
 
 // Execute an arc in offset mode format. position == current xyz, target == target xyz,
@@ -102,6 +421,9 @@ void mc_arc(float *target, plan_line_data_t *pl_data, float *position, float *of
     if (angular_travel <= ARC_ANGULAR_TRAVEL_EPSILON) { angular_travel += 2*M_PI; }
   }
 
+  if (kinematics_segment_arc(target, pl_data, position, offset, radius, axis_0, axis_1, axis_linear,
+                             angular_travel)) { return; }
+
   // NOTE: Segment end points are on the arc, which can lead to the arc diameter being smaller by up to
   // (2x) settings.arc_tolerance. For 99% of users, this is just fine. If a different arc segment fit
   // is desired, i.e. least-squares, midpoint on arc, just change the mm_per_arc_segment calculation.
@@ -195,6 +517,9 @@ void mc_arc(float *target, plan_line_data_t *pl_data, float *position, float *of
 void mc_dwell(float seconds)
 {
   if (sys.state == STATE_CHECK_MODE) { return; }
+  #ifdef TEACH_AND_REPLAY
+    if (teach_record_command(TEACH_RECORD_DWELL, 0, seconds)) { return; }
+  #endif
   protocol_buffer_synchronize();
   delay_sec(seconds, DELAY_MODE_DWELL);
 }
@@ -263,6 +588,10 @@ uint8_t mc_probe_cycle(float *target, plan_line_data_t *pl_data, uint8_t parser_
 {
   // TODO: Need to update this cycle so it obeys a non-auto cycle start.
   if (sys.state == STATE_CHECK_MODE) { return(GC_PROBE_CHECK_MODE); }
+  #ifdef TEACH_AND_REPLAY
+    // A probe result can not be replayed. Skipped like check mode, since recording moves nothing.
+    if (teach_recording()) { teach_break(); return(GC_PROBE_CHECK_MODE); }
+  #endif
 
   // Finish all queued commands and empty planner buffer before starting probe cycle.
   protocol_buffer_synchronize();
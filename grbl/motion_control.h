@@ -38,6 +38,27 @@
 // (1 minute)/feed_rate time.
 void mc_line(float *target, plan_line_data_t *pl_data);
 
+#ifdef SCARA
+  // Execute a linear motion of the joints to target[N_AXIS] in joint degrees, and Z in mm. Planned as
+  // a single joint space block, without kinematics or segmentation. Used by joint jogs.
+  void mc_joint_line(float *target, plan_line_data_t *pl_data);
+#endif
+
+// Waits for room in the planner buffer and queues a single planner block. Called through
+// kinematics_segment_line(). For SCARA machines, target[N_AXIS] is in joint space and cartesian[N_AXIS]
+// is its machine position, or NULL to plan the block in joint space.
+#ifdef SCARA
+  void mc_buffer_line(float *target, float *cartesian, plan_line_data_t *pl_data);
+
+  // SCARA line and arc segmentation. Called through kinematics_segment_line() and
+  // kinematics_segment_arc().
+  uint8_t mc_scara_line(float *target, plan_line_data_t *pl_data, uint8_t is_jog);
+  void mc_scara_arc(float *target, plan_line_data_t *pl_data, float *position, float *offset, float radius,
+    uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, float angular_travel);
+#else
+  void mc_buffer_line(float *target, plan_line_data_t *pl_data);
+#endif
+
 // Execute an arc in offset mode format. position == current xyz, target == target xyz,
 // offset == offset from current xyz, axis_XXX defines circle plane in tool space, axis_linear is
 // the direction of helical travel, radius == circle radius, is_clockwise_arc boolean. Used
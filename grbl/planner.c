@@ -36,6 +36,13 @@ typedef struct {
                                      // i.e. arcs, canned cycles, and backlash compensation.
   float previous_unit_vec[N_AXIS];   // Unit vector of previous path line segment
   float previous_nominal_speed;  // Nominal speed of previous path line segment
+  #ifdef IS_SCARA
+    float position_cartesian[N_AXIS]; // End point of the last planned block in machine coordinates (mm).
+    uint8_t previous_joint_space;     // Previous block was planned in joint space.
+  #endif
+  #ifdef TEACH_AND_REPLAY
+    uint8_t start_from_rest;          // Previous unit vector is unknown. Set after replayed blocks.
+  #endif
 } planner_t;
 static planner_t pl;
 
@@ -246,6 +253,16 @@ float plan_get_exec_block_exit_speed_sqr()
 }
 
 
+#ifdef S_CURVE_ACCELERATION
+plan_block_t *plan_get_next_block(plan_block_t *block)
+{
+  uint8_t block_index = plan_next_block_index(block - block_buffer);
+  if (block_index == block_buffer_head) { return(NULL); }
+  return(&block_buffer[block_index]);
+}
+#endif
+
+
 // Returns the availability status of the block ring buffer. True, if full.
 uint8_t plan_check_full_buffer()
 {
@@ -269,6 +286,23 @@ float plan_compute_profile_nominal_speed(plan_block_t *block)
 }
 
 
+#ifdef S_CURVE_ACCELERATION
+// Same as limit_value_by_axis_maximum() for the jerk settings, except that an axis jerk of zero places
+// no limit on the block jerk.
+static float plan_compute_jerk(float *unit_vec)
+{
+  uint8_t idx;
+  float jerk = SOME_LARGE_VALUE;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if ((unit_vec[idx] != 0) && (settings.jerk[idx] > 0.0f)) {
+      jerk = min(jerk,fabsf(settings.jerk[idx]/unit_vec[idx]));
+    }
+  }
+  return(jerk);
+}
+#endif
+
+
 // Computes and updates the max entry speed (sqr) of the block, based on the minimum of the junction's
 // previous and current nominal speeds and max junction speed.
 static void plan_compute_profile_parameters(plan_block_t *block, float nominal_speed, float prev_nominal_speed)
@@ -311,8 +345,15 @@ void plan_update_velocity_profile_parameters()
    The system motion condition tells the planner to plan a motion in the always unused block buffer
    head. It avoids changing the planner state and preserves the buffer to ensure subsequent gcode
    motions are still planned correctly, while the stepper module only points to the block buffer head
-   to execute the special system motion. */
-uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
+   to execute the special system motion.
+   NOTE: plan_buffer_line() maps the target to axis coordinates by kinematics_inverse() and passes
+   it on to plan_buffer_axis_line(), where the steps and planning are done. For SCARA machines, the
+   axis target is in joint space. Given the Cartesian end point, the block is planned in Cartesian
+   mm and mm/min. The joint deltas per Cartesian mm are the Jacobian mapped direction of the line,
+   so limiting them by the axis maximums caps the block rate and acceleration at the joint max_rate
+   and acceleration settings. Without it (system motions, joint jogs and rapids), the block is
+   planned in joint space with degrees as mm. */
+static uint8_t plan_buffer_axis_line(float *target, float *cartesian, plan_line_data_t *pl_data)
 {
   // Prepare and initialize new block. Copy relevant pl_data for block execution.
   plan_block_t *block = &block_buffer[block_buffer_head];
@@ -329,59 +370,24 @@ uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
   int32_t target_steps[N_AXIS], position_steps[N_AXIS];
   float unit_vec[N_AXIS], delta_mm;
   uint8_t idx;
-#ifdef IS_SCARA
-  float target_float[N_AXIS];
-#endif
   // Copy position data based on type of motion being planned.
-  if (block->condition & PL_COND_FLAG_SYSTEM_MOTION) {
-#ifdef COREXY
-    position_steps[X_AXIS] = system_convert_corexy_to_x_axis_steps(sys_position);
-    position_steps[Y_AXIS] = system_convert_corexy_to_y_axis_steps(sys_position);
-    position_steps[Z_AXIS] = sys_position[Z_AXIS];
-#else
-    memcpy(position_steps, sys_position, sizeof(sys_position));
-#endif
-  }
+  if (block->condition & PL_COND_FLAG_SYSTEM_MOTION) { kinematics_motor_to_axis_steps(position_steps, sys_position); }
   else { memcpy(position_steps, pl.position, sizeof(pl.position)); }
 
-#ifdef COREXY
-	target_steps[A_MOTOR] = lround(target[A_MOTOR]*settings.steps_per_mm[A_MOTOR]);
-	target_steps[B_MOTOR] = lround(target[B_MOTOR]*settings.steps_per_mm[B_MOTOR]);
-	block->steps[A_MOTOR] = labs((target_steps[X_AXIS]-position_steps[X_AXIS]) + (target_steps[Y_AXIS]-position_steps[Y_AXIS]));
-	block->steps[B_MOTOR] = labs((target_steps[X_AXIS]-position_steps[X_AXIS]) - (target_steps[Y_AXIS]-position_steps[Y_AXIS]));
-#endif
-#if IS_SCARA
-	inverse_kinematics(target,target_float);
-#endif
+  // Calculate target position in absolute steps and the move in motor steps.
+  int32_t delta_steps[N_AXIS];
+  for (idx=0; idx<N_AXIS; idx++) {
+    target_steps[idx] = lroundf(target[idx]*settings.steps_per_mm[idx]);
+    delta_steps[idx] = target_steps[idx]-position_steps[idx];
+  }
+  kinematics_axis_to_motor_steps(delta_steps);
   for (idx=0; idx<N_AXIS; idx++) {
-    // Calculate target position in absolute steps, number of steps for each axis, and determine max step events.
+    // Calculate number of steps for each motor and determine max step events.
     // Also, compute individual axes distance for move and prep unit vector calculations.
     // NOTE: Computes true distance from converted step values.
-    #ifdef COREXY
-      if ( !(idx == A_MOTOR) && !(idx == B_MOTOR) ) {
-        target_steps[idx] = lroundf(target[idx]*settings.steps_per_mm[idx]);
-        block->steps[idx] = fabsf(target_steps[idx]-position_steps[idx]);
-      }
-      block->step_event_count = max(block->step_event_count, block->steps[idx]);
-      if (idx == A_MOTOR) {
-        delta_mm = (target_steps[X_AXIS]-position_steps[X_AXIS] + target_steps[Y_AXIS]-position_steps[Y_AXIS])/settings.steps_per_mm[idx];
-      } else if (idx == B_MOTOR) {
-        delta_mm = (target_steps[X_AXIS]-position_steps[X_AXIS] - target_steps[Y_AXIS]+position_steps[Y_AXIS])/settings.steps_per_mm[idx];
-      } else {
-        delta_mm = (target_steps[idx] - position_steps[idx])/settings.steps_per_mm[idx];
-      }
-	#elif IS_SCARA
-      target_steps[idx] = lroundf(target_float[idx]*settings.steps_per_mm[idx]);
-      block->steps[idx] = abs(target_steps[idx]-position_steps[idx]);
-      block->step_event_count = max(block->step_event_count, block->steps[idx]);
-      delta_mm = (target_steps[idx] - position_steps[idx])/settings.steps_per_mm[idx];
-
-    #else
-      target_steps[idx] = lroundf(target[idx]*settings.steps_per_mm[idx]);
-      block->steps[idx] = abs(target_steps[idx]-position_steps[idx]);
-      block->step_event_count = max(block->step_event_count, block->steps[idx]);
-      delta_mm = (target_steps[idx] - position_steps[idx])/settings.steps_per_mm[idx];
-	  #endif
+    block->steps[idx] = labs(delta_steps[idx]);
+    block->step_event_count = max(block->step_event_count, block->steps[idx]);
+    delta_mm = delta_steps[idx]/settings.steps_per_mm[idx];
     unit_vec[idx] = delta_mm; // Store unit vector numerator
 
     // Set direction bits. Bit enabled always means direction is negative.
@@ -395,9 +401,39 @@ uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
   // down such that no individual axes maximum values are exceeded with respect to the line direction.
   // NOTE: This calculation assumes all axes are orthogonal (Cartesian) and works with ABC-axes,
   // if they are also orthogonal/independent. Operates on the absolute value of the unit vector.
-  block->millimeters = convert_delta_vector_to_unit_vector(unit_vec);
-  block->acceleration = limit_value_by_axis_maximum(settings.acceleration, unit_vec);
-  block->rapid_rate = limit_value_by_axis_maximum(settings.max_rate, unit_vec);
+  #ifdef IS_SCARA
+    float cartesian_vec[N_AXIS];
+    float cartesian_mm = 0.0f;
+    if ((cartesian != NULL) && !(block->condition & PL_COND_FLAG_SYSTEM_MOTION)) {
+      for (idx=0; idx<N_AXIS; idx++) { cartesian_vec[idx] = cartesian[idx]-pl.position_cartesian[idx]; }
+      cartesian_mm = convert_delta_vector_to_unit_vector(cartesian_vec);
+    }
+    if (cartesian_mm > 0.0f) {
+      // Joint degrees per Cartesian mm. Not a unit vector.
+      float inv_cartesian_mm = 1.0f/cartesian_mm;
+      for (idx=0; idx<N_AXIS; idx++) { unit_vec[idx] *= inv_cartesian_mm; }
+      block->millimeters = cartesian_mm;
+      block->acceleration = limit_value_by_axis_maximum(settings.acceleration, unit_vec);
+      #ifdef S_CURVE_ACCELERATION
+        block->jerk = plan_compute_jerk(unit_vec);
+      #endif
+      block->rapid_rate = limit_value_by_axis_maximum(settings.max_rate, unit_vec);
+      // The joint rates above are averaged over the block. Near a singularity, they peak at the block
+      // ends, which the segmentation bounds with the Jacobian. Lowers the nominal speed of feeds too.
+      if ((pl_data->joint_rate_limit > 0.0f) && (pl_data->joint_rate_limit < block->rapid_rate)) {
+        block->rapid_rate = pl_data->joint_rate_limit;
+      }
+      memcpy(unit_vec, cartesian_vec, sizeof(cartesian_vec)); // Junctions are in Cartesian space.
+    } else
+  #endif
+  {
+    block->millimeters = convert_delta_vector_to_unit_vector(unit_vec);
+    block->acceleration = limit_value_by_axis_maximum(settings.acceleration, unit_vec);
+    #ifdef S_CURVE_ACCELERATION
+      block->jerk = plan_compute_jerk(unit_vec);
+    #endif
+    block->rapid_rate = limit_value_by_axis_maximum(settings.max_rate, unit_vec);
+  }
 
   // Store programmed rate.
   if (block->condition & PL_COND_FLAG_RAPID_MOTION) { block->programmed_rate = block->rapid_rate; }
@@ -407,7 +443,13 @@ uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
   }
 
   // TODO: Need to check this method handling zero junction speeds when starting from rest.
+  #ifdef TEACH_AND_REPLAY
+  // A recording queues no blocks, so its junctions join the previous recorded block, as in a replay.
+  if (((block_buffer_head == block_buffer_tail) && !teach_recording()) ||
+      (block->condition & PL_COND_FLAG_SYSTEM_MOTION) || pl.start_from_rest) {
+  #else
   if ((block_buffer_head == block_buffer_tail) || (block->condition & PL_COND_FLAG_SYSTEM_MOTION)) {
+  #endif
 
     // Initialize block entry speed as zero. Assume it will be starting from rest. Planner will correct this later.
     // If system motion, the system motion block always is assumed to start from rest and end at a complete stop.
@@ -454,12 +496,22 @@ uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
         block->max_junction_speed_sqr = SOME_LARGE_VALUE;
       } else {
         convert_delta_vector_to_unit_vector(junction_unit_vec);
-        float junction_acceleration = limit_value_by_axis_maximum(settings.acceleration, junction_unit_vec);
+        #ifdef IS_SCARA
+          // Cartesian junction. The joint mapped acceleration of the new block bounds it instead.
+          float junction_acceleration = (cartesian_mm > 0.0f ? block->acceleration :
+                                         limit_value_by_axis_maximum(settings.acceleration, junction_unit_vec));
+        #else
+          float junction_acceleration = limit_value_by_axis_maximum(settings.acceleration, junction_unit_vec);
+        #endif
         float sin_theta_d2 = sqrtf(0.5f*(1.0f-junction_cos_theta)); // Trig half angle identity. Always positive.
         block->max_junction_speed_sqr = max( MINIMUM_JUNCTION_SPEED*MINIMUM_JUNCTION_SPEED,
                        (junction_acceleration * settings.junction_deviation * sin_theta_d2)/(1.0f-sin_theta_d2) );
       }
     }
+    #ifdef IS_SCARA
+      // Joint space and Cartesian blocks share neither direction nor speed units. Stop between them.
+      if ((!(cartesian_mm > 0.0f)) != pl.previous_joint_space) { block->max_junction_speed_sqr = 0.0f; }
+    #endif
   }
 
   // Block system motion from updating this data to ensure next g-code motion is computed correctly.
@@ -468,9 +520,22 @@ uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
     plan_compute_profile_parameters(block, nominal_speed, pl.previous_nominal_speed);
     pl.previous_nominal_speed = nominal_speed;
 
+    #ifdef TEACH_AND_REPLAY
+      uint8_t is_recorded = teach_record_block(block, pl.position, target_steps);
+      pl.start_from_rest = false;
+    #endif
+
     // Update previous path unit_vector and planner position.
     memcpy(pl.previous_unit_vec, unit_vec, sizeof(unit_vec)); // pl.previous_unit_vec[] = unit_vec[]
     memcpy(pl.position, target_steps, sizeof(target_steps)); // pl.position[] = target_steps[]
+    #ifdef IS_SCARA
+      if (cartesian != NULL) { memcpy(pl.position_cartesian, cartesian, sizeof(pl.position_cartesian)); }
+      else { forward_kinematics_SCARA(target, pl.position_cartesian); }
+      pl.previous_joint_space = !(cartesian_mm > 0.0f);
+    #endif
+    #ifdef TEACH_AND_REPLAY
+      if (is_recorded) { return(PLAN_OK); } // Written to flash instead. Never queued.
+    #endif
 
     // New block is all set. Update buffer head and next buffer head indices.
     block_buffer_head = next_buffer_head;
@@ -483,26 +548,90 @@ uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
 }
 
 
+uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data)
+{
+  float axis_target[N_AXIS];
+  kinematics_inverse(axis_target, target);
+  return(plan_buffer_axis_line(axis_target, target, pl_data));
+}
+
+
+#ifdef IS_SCARA
+uint8_t plan_buffer_joint_line(float *target, float *cartesian, plan_line_data_t *pl_data)
+{
+  return(plan_buffer_axis_line(target, cartesian, pl_data));
+}
+#endif
+
+
 // Reset the planner position vectors. Called by the system abort/initialization routine.
 void plan_sync_position()
 {
   // TODO: For motor configurations not in the same coordinate frame as the machine position,
   // this function needs to be updated to accomodate the difference.
+  kinematics_motor_to_axis_steps(pl.position, sys_position);
+  #ifdef IS_SCARA
+    kinematics_forward(pl.position_cartesian, pl.position);
+  #endif
+}
+
+
+// Returns the planner position in absolute machine coordinates. This is the end point of the last
+// planned block, where the next line motion starts.
+void plan_get_planner_mpos(float *target)
+{
+  #ifdef IS_SCARA
+    memcpy(target, pl.position_cartesian, sizeof(pl.position_cartesian)); // Avoids forward kinematics.
+  #else
+    kinematics_forward(target, pl.position); // NOTE: Planner position is kept in axis steps.
+  #endif
+}
+
+
+#ifdef TEACH_AND_REPLAY
+void plan_get_planner_steps(int32_t *steps)
+{
+  memcpy(steps, pl.position, sizeof(pl.position));
+}
+
+
+// The steps, rates and junction speed limit of a recorded block were planned when it was recorded,
+// against the same preceding block. Only the speed profile is recomputed for the current overrides.
+// The first block of a replay starts from rest, since it may follow any other motion.
+void plan_buffer_recorded_block(plan_block_t *recorded, int32_t *target_steps, uint8_t from_rest)
+{
+  plan_block_t *block = &block_buffer[block_buffer_head];
+  memcpy(block, recorded, sizeof(plan_block_t));
+  block->entry_speed_sqr = 0.0f;
+  if (from_rest || (block_buffer_head == block_buffer_tail)) { block->max_junction_speed_sqr = 0.0f; }
+  float nominal_speed = plan_compute_profile_nominal_speed(block);
+  plan_compute_profile_parameters(block, nominal_speed, pl.previous_nominal_speed);
+  pl.previous_nominal_speed = nominal_speed;
+  memcpy(pl.position, target_steps, sizeof(pl.position));
+
+  block_buffer_head = next_buffer_head;
+  next_buffer_head = plan_next_block_index(block_buffer_head);
+  planner_recalculate();
+}
+
+
+void plan_start_from_rest()
+{
+  pl.start_from_rest = true;
+  #ifdef IS_SCARA
+    kinematics_forward(pl.position_cartesian, pl.position);
+  #endif
+}
+#endif
+
+
+#ifdef IS_SCARA
+void plan_get_planner_joint_position(float *target)
+{
   uint8_t idx;
-  for (idx=0; idx<N_AXIS; idx++) {
-    #ifdef COREXY
-      if (idx==X_AXIS) {
-        pl.position[X_AXIS] = system_convert_corexy_to_x_axis_steps(sys_position);
-      } else if (idx==Y_AXIS) {
-        pl.position[Y_AXIS] = system_convert_corexy_to_y_axis_steps(sys_position);
-      } else {
-        pl.position[idx] = sys_position[idx];
-      }
-    #else
-      pl.position[idx] = sys_position[idx];
-    #endif
-  }
+  for (idx=0; idx<N_AXIS; idx++) { target[idx] = pl.position[idx]/settings.steps_per_mm[idx]; }
 }
+#endif
 
 
 // Returns the number of available blocks are in the planner buffer.
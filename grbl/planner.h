@@ -74,6 +74,9 @@ typedef struct {
   float max_entry_speed_sqr; // Maximum allowable entry speed based on the minimum of junction limit and
                              //   neighboring nominal speeds with overrides in (mm/min)^2
   float acceleration;        // Axis-limit adjusted line acceleration in (mm/min^2). Does not change.
+  #ifdef S_CURVE_ACCELERATION
+    float jerk;              // Axis-limit adjusted line jerk in (mm/min^3). SOME_LARGE_VALUE if unlimited.
+  #endif
   float millimeters;         // The remaining distance for this block to be executed in (mm).
                              // NOTE: This value may be altered by stepper algorithm during execution.
 
@@ -97,6 +100,9 @@ typedef struct {
   #ifdef USE_LINE_NUMBERS
     int32_t line_number;    // Desired line number to report when executing.
   #endif
+  #ifdef SCARA
+    float joint_rate_limit; // Cartesian rate (mm/min) at which a joint reaches its max rate. Zero if unused.
+  #endif
 } plan_line_data_t;
 
 
@@ -109,6 +115,17 @@ void plan_reset_buffer(); // Reset buffer only.
 // rate is taken to mean "frequency" and would complete the operation in 1/feed_rate minutes.
 uint8_t plan_buffer_line(float *target, plan_line_data_t *pl_data);
 
+#ifdef SCARA
+// Same as plan_buffer_line(), but target[N_AXIS] is already in joint space (degrees and Z mm).
+// Used by the SCARA line segmentation, which solves the kinematics itself. cartesian[N_AXIS] is the
+// same end point in machine coordinates, which the block is planned in. If NULL, the block is
+// planned in joint space.
+uint8_t plan_buffer_joint_line(float *target, float *cartesian, plan_line_data_t *pl_data);
+
+// Returns the joint angles of the planner position in degrees, and Z in mm.
+void plan_get_planner_joint_position(float *target);
+#endif
+
 // Called when the current block is no longer needed. Discards the block and makes the memory
 // availible for new blocks.
 void plan_discard_current_block();
@@ -125,6 +142,12 @@ uint8_t plan_next_block_index(uint8_t block_index);
 // Called by step segment buffer when computing executing block velocity profile.
 float plan_get_exec_block_exit_speed_sqr();
 
+#ifdef S_CURVE_ACCELERATION
+// Returns the planner block following 'block', or NULL if it is the last one. Called by the step
+// segment buffer to look ahead through the blocks an S-curve ramp spans.
+plan_block_t *plan_get_next_block(plan_block_t *block);
+#endif
+
 // Called by main program during planner calculations and step segment buffer during initialization.
 float plan_compute_profile_nominal_speed(plan_block_t *block);
 
@@ -147,7 +170,21 @@ uint8_t plan_get_block_buffer_count();
 // Returns the status of the block ring buffer. True, if buffer is full.
 uint8_t plan_check_full_buffer();
 
+// Returns the planner position in absolute machine coordinates (end point of the last planned block).
 void plan_get_planner_mpos(float *target);
 
+#ifdef TEACH_AND_REPLAY
+// Returns the planner position in axis steps.
+void plan_get_planner_steps(int32_t *steps);
+
+// Queues a block recorded by teach mode, which ends at target_steps[N_AXIS] in axis steps. Assumes
+// the buffer is available, like plan_buffer_line().
+void plan_buffer_recorded_block(plan_block_t *recorded, int32_t *target_steps, uint8_t from_rest);
+
+// Starts the next block from rest, and syncs the planner state recorded blocks do not carry. Called
+// when a recording starts or stops and after a replay.
+void plan_start_from_rest();
+#endif
+
 
 #endif
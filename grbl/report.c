@@ -213,6 +213,32 @@ void report_grbl_settings() {
   #else
     report_util_uint8_setting(32,0);
   #endif
+  #ifdef INPUT_SHAPING
+    report_util_uint8_setting(36,settings.shaper_type);
+    report_util_float_setting(37,settings.shaper_frequency,N_DECIMAL_SETTINGVALUE);
+    report_util_float_setting(38,settings.shaper_damping,N_DECIMAL_SETTINGVALUE);
+  #endif
+#ifdef SCARA
+  report_util_float_setting(40,settings.scara_segments_per_second,N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(41,settings.scara_chordal_tolerance,N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(42,settings.scara_linkage[0],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(43,settings.scara_linkage[1],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(44,settings.scara_offset[X_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(45,settings.scara_offset[Y_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(46,settings.scara_home_pos[X_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(47,settings.scara_home_pos[Y_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(48,settings.scara_home_pos[Z_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(50,settings.scara_joint_min[X_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(51,settings.scara_joint_max[X_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(52,settings.scara_joint_min[Y_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(53,settings.scara_joint_max[Y_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_uint8_setting(54,settings.scara_elbow);
+  report_util_float_setting(55,settings.scara_joint_offset[X_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(56,settings.scara_joint_offset[Y_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(57,settings.scara_tool_offset[X_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(58,settings.scara_tool_offset[Y_AXIS],N_DECIMAL_SETTINGVALUE);
+  report_util_float_setting(59,settings.scara_tool_wrist,N_DECIMAL_SETTINGVALUE);
+#endif
 
   // Print axis settings
   uint8_t idx, set_idx;
@@ -224,6 +250,9 @@ void report_grbl_settings() {
         case 1: report_util_float_setting(val+idx,settings.max_rate[idx],N_DECIMAL_SETTINGVALUE); break;
         case 2: report_util_float_setting(val+idx,settings.acceleration[idx]/(60*60),N_DECIMAL_SETTINGVALUE); break;
         case 3: report_util_float_setting(val+idx,-settings.max_travel[idx],N_DECIMAL_SETTINGVALUE); break;
+        #ifdef S_CURVE_ACCELERATION
+          case 4: report_util_float_setting(val+idx,settings.jerk[idx]/(60*60*60),N_DECIMAL_SETTINGVALUE); break;
+        #endif
       }
     }
     val += AXIS_SETTINGS_INCREMENT;
@@ -448,6 +477,33 @@ void report_build_info(char *line)
 	print_uint8_base10(RX_BUFFER_SIZE);
 
 	report_util_feedback_line_feed();
+
+  #ifdef STM32F103C8
+    // Step rate ceiling in Hz, and the worst stepper interrupt time in CPU cycles it was found from.
+    uint32_t isr_cycles;
+    printPgmString(PSTR("[STEP:"));
+    print_uint32_base10(st_get_max_step_rate(&isr_cycles));
+    serial_write(',');
+    print_uint32_base10(isr_cycles);
+    report_util_feedback_line_feed();
+    // Segment prep CPU load in percent of the time motion ran, and the mean CPU cycles per segment,
+    // since the last $I.
+    uint32_t segment_cycles;
+    printPgmString(PSTR("[PREP:"));
+    printFloat(st_get_prep_load(&segment_cycles), 1);
+    serial_write(',');
+    print_uint32_base10(segment_cycles);
+    report_util_feedback_line_feed();
+    #ifdef SCARA
+      // Mean CPU cycles per inverse kinematics call of the float and fixed-point kernels.
+      uint32_t fixed_cycles;
+      printPgmString(PSTR("[IK:"));
+      print_uint32_base10(scara_ik_cycles(&fixed_cycles));
+      serial_write(',');
+      print_uint32_base10(fixed_cycles);
+      report_util_feedback_line_feed();
+    #endif
+  #endif
 }
 
 
@@ -469,9 +525,9 @@ void report_realtime_status()
 {
   uint8_t idx;
   int32_t current_position[N_AXIS]; // Copy current state of the system position variable
-  memcpy(current_position, sys_position, sizeof(sys_position));
+  st_get_position(current_position);
   float print_position[N_AXIS];
-  system_convert_array_steps_to_mpos(print_position, current_position);
+  kinematics_report_position(print_position, current_position);
 
   // Report current machine state and sub-states
   serial_write('<');
@@ -570,6 +626,20 @@ void report_realtime_status()
 #endif      
 #endif
 
+#ifdef IS_SCARA
+  // Report SCARA joint rate scaling. Shown while the executing block runs below its programmed feed
+  // to keep the joint rates within $110-$112, as a percentage of the programmed and overridden feed.
+  plan_block_t * js_block = plan_get_current_block();
+  if ((js_block != NULL) && !(js_block->condition & PL_COND_FLAG_RAPID_MOTION)) {
+    float js_rate = js_block->programmed_rate;
+    if (!(js_block->condition & PL_COND_FLAG_NO_FEED_OVERRIDE)) { js_rate *= (0.01f*sys.f_override); }
+    if (js_rate > js_block->rapid_rate) {
+      printPgmString(PSTR("|Js:"));
+      print_uint8_base10((uint8_t)(100.0f*js_block->rapid_rate/js_rate));
+    }
+  }
+#endif
+
 #ifdef REPORT_FIELD_PIN_STATE
   uint8_t lim_pin_state = limits_get_state();
   uint8_t ctrl_pin_state = system_control_get_state();
@@ -653,6 +723,13 @@ void report_realtime_status()
 #ifdef DEBUG
   void report_realtime_debug()
   {
-
+    uint32_t latency, cycles;
+    st_get_isr_cycles(&latency, &cycles);
+    printPgmString(PSTR("{ISR:"));
+    print_uint32_base10(latency);
+    serial_write(',');
+    print_uint32_base10(cycles);
+    serial_write('}');
+    report_util_line_feed();
   }
 #endif
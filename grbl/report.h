@@ -60,6 +60,10 @@
 #define STATUS_GCODE_G43_DYNAMIC_AXIS_ERROR 37
 #define STATUS_GCODE_MAX_VALUE_EXCEEDED 38
 
+#define STATUS_CALIBRATION_FAILED 39
+#define STATUS_TEACH_INVALID 40
+#define STATUS_TEACH_NOT_AT_START 41
+
 // Define Grbl alarm codes. Valid values (1-255). 0 is reserved.
 #define ALARM_HARD_LIMIT_ERROR      EXEC_ALARM_HARD_LIMIT
 #define ALARM_SOFT_LIMIT_ERROR      EXEC_ALARM_SOFT_LIMIT
@@ -70,6 +74,7 @@
 #define ALARM_HOMING_FAIL_DOOR      EXEC_ALARM_HOMING_FAIL_DOOR
 #define ALARM_HOMING_FAIL_PULLOFF   EXEC_ALARM_HOMING_FAIL_PULLOFF
 #define ALARM_HOMING_FAIL_APPROACH  EXEC_ALARM_HOMING_FAIL_APPROACH
+#define ALARM_WORKSPACE_ERROR       EXEC_ALARM_WORKSPACE
 
 // Define Grbl feedback message codes. Valid values (0-255).
 #define MESSAGE_CRITICAL_EVENT 1
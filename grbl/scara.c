@@ -20,61 +20,493 @@
 
 #include "grbl.h"
 
-float const L1 = SCARA_LINKAGE_1,
-            L2 = SCARA_LINKAGE_2,
-            L1_2 = sq(SCARA_LINKAGE_1),
-            L2_2 = sq(SCARA_LINKAGE_2);
+#ifdef SCARA
 
-u8 angle_mode=false;
+scara_t scara;
 
-float ManualHomePos[3]={MANUAL_X_HOME_POS,MANUAL_Y_HOME_POS,MANUAL_Z_HOME_POS}; 
+// Status report position cache. Polls land mostly on an idle arm, or a few dozen steps on from the
+// last one, so the forward kinematics are reused while the steps are unchanged and otherwise advanced
+// by rotating the cached sines and cosines. No libm calls for either.
+#define SCARA_REPORT_MAX_ROTATION 0.05f // radians. Larger joint moves are solved exactly.
+#define SCARA_REPORT_RESYNC 32 // Rotations between exact solves. Bounds float rounding drift.
+
+static struct {
+  int32_t steps[N_AXIS];
+  float position[N_AXIS];
+  scara_jacobian_t pose; // Arm angles of steps[] and their sines and cosines
+  uint8_t rotations; // Since the last exact solve. SCARA_REPORT_RESYNC forces the next one.
+} report_cache;
+
+void scara_init()
+{
+    scara.l1 = settings.scara_linkage[0];
+    scara.offset_x = settings.scara_offset[X_AXIS];
+    scara.offset_y = settings.scara_offset[Y_AXIS];
+    scara.zero_theta = settings.scara_joint_offset[X_AXIS];
+    // Tool frame. The outer arm points along (-cos(psi),sin(psi)), which turns clockwise as psi grows.
+    // A tip at (L2+tool_x,tool_y) in the arm frame is reached by an outer arm as long as that vector,
+    // at psi less the angle of the vector.
+    float wrist = RADIANS(settings.scara_tool_wrist);
+    float sin_w = sinf(wrist), cos_w = cosf(wrist);
+    scara.tool_x = settings.scara_tool_offset[X_AXIS]*cos_w - settings.scara_tool_offset[Y_AXIS]*sin_w;
+    scara.tool_y = settings.scara_tool_offset[X_AXIS]*sin_w + settings.scara_tool_offset[Y_AXIS]*cos_w;
+    float arm_x = settings.scara_linkage[1] + scara.tool_x;
+    scara.l2 = sqrtf(arm_x*arm_x + scara.tool_y*scara.tool_y);
+    scara.zero_psi = settings.scara_joint_offset[Y_AXIS] - DEGREES(atan2f(scara.tool_y, arm_x));
+    scara.sum_sq = sq(scara.l1) + sq(scara.l2);
+    scara.inv_2l1l2 = 1.0f/(2.0f*scara.l1*scara.l2);
+    scara.inv_l1 = 1.0f/scara.l1;
+    scara.inv_l2 = 1.0f/scara.l2;
+    scara.min_r2 = sq((scara.l1-scara.l2));
+    scara.max_r2 = sq((scara.l1+scara.l2));
+    report_cache.rotations = SCARA_REPORT_RESYNC; // Geometry changed. Drop the cached position.
+#ifdef SCARA_FIXED_POINT_IK
+    scara.l1_q16 = lroundf(scara.l1*65536.0f);
+    scara.l2_q16 = lroundf(scara.l2*65536.0f);
+    scara.offset_x_q16 = lroundf(scara.offset_x*65536.0f);
+    scara.offset_y_q16 = lroundf(scara.offset_y*65536.0f);
+    scara.sum_sq_q32 = (int64_t)((double)scara.sum_sq*4294967296.0);
+    scara.two_l1l2_q32 = (int64_t)(2.0*scara.l1*scara.l2*4294967296.0);
+    scara.inv_2l1l2_q46 = (int64_t)(70368744177664.0/(2.0*scara.l1*scara.l2));
+#endif
+}
 
 void forward_kinematics_SCARA(float const *f_scara, float *cartesian)
 {
     float x_sin, x_cos, y_sin, y_cos;
 
-    x_sin = sin(RADIANS(f_scara[X_AXIS])) * L1;
-    x_cos = cos(RADIANS(f_scara[X_AXIS])) * L1;
-    y_sin = sin(RADIANS(f_scara[Y_AXIS])) * L2;//YСϵתǶʱʹô˹ʽ
-    y_cos = cos(RADIANS(f_scara[Y_AXIS])) * L2;//YСϵתǶʱʹô˹ʽ
+    float theta = RADIANS(f_scara[X_AXIS] + scara.zero_theta);
+    float psi = RADIANS(f_scara[Y_AXIS] + scara.zero_psi);
+
+    x_sin = sin(theta) * scara.l1;
+    x_cos = cos(theta) * scara.l1;
+    y_sin = sin(psi) * scara.l2;//YСϵתǶʱʹô˹ʽ
+    y_cos = cos(psi) * scara.l2;//YСϵתǶʱʹô˹ʽ
 
-    cartesian[X_AXIS] = -x_cos - y_cos - SCARA_OFFSET_X;  //ûϵXֵ
-    cartesian[Y_AXIS] = x_sin + y_sin - SCARA_OFFSET_Y;  //ûϵYֵ
+    cartesian[X_AXIS] = -x_cos - y_cos - scara.offset_x;  //ûϵXֵ
+    cartesian[Y_AXIS] = x_sin + y_sin - scara.offset_y;  //ûϵYֵ
     cartesian[Z_AXIS] = (float)f_scara[Z_AXIS];
 
 }
 
-void inverse_kinematics(float const *cartesian, float *f_scara)
+#ifdef SCARA_FIXED_POINT_IK
+// Fixed-point inverse kinematics kernel. Positions are Q16 mm, cosine/sine of the elbow angle Q30 and
+// angles Q28 radians. The only transcendental functions, atan2 and sqrt, are interpolated from the
+// tables below, and the one division left is a 32-bit hardware UDIV seeding a reciprocal.
+// Worst-case joint angle error against a double precision solve is 7.6e-6 rad (0.00043 deg) over the
+// reachable annulus of the default arm, rising to 1.2e-5 rad within 5mm of the tower axis, where the
+// float kernel itself is off by 1.0e-5 rad. This is under 1/14 of a 0.0102 deg motor step at the
+// default 97.78 steps/deg, so joint step counts match the float kernel all but at rounding edges.
+// A call takes three UDIV, about 15 UMULL/SMULL and the float conversions of its inputs and outputs,
+// against a soft-float sqrtf() and three atan2f() for the float kernel. Its cycle count on the target
+// is measured on the board by scara_ik_cycles(), reported by $I. The host times of 'make bench' do
+// not carry over to a CPU without an FPU.
+#define IK_Q16(x) ((int32_t)((x)*65536.0f))
+#define IK_PI_Q28 843314857 // pi*2^28
+#define IK_PI_2_Q30 1686629713 // pi/2*2^30
+#define IK_Q28_TO_DEGREES (float)(180.0/(M_PI*268435456.0))
+
+// atan(i/256) for i = 0..256 in Q30 radians.
+static const int32_t ik_atan_table[257] = {
+  0, 4194283, 8388437, 12582336, 16775851, 20968854, 25161218, 29352814,
+  33543516, 37733196, 41921726, 46108981, 50294833, 54479155, 58661822, 62842708,
+  67021687, 71198634, 75373424, 79545932, 83716036, 87883610, 92048532, 96210679,
+  100369930, 104526161, 108679253, 112829084, 116975536, 121118487, 125257820, 129393416,
+  133525159, 137652930, 141776614, 145896097, 150011262, 154121996, 158228185, 162329719,
+  166426484, 170518371, 174605269, 178687069, 182763663, 186834944, 190900805, 194961140,
+  199015846, 203064818, 207107953, 211145151, 215176309, 219201328, 223220110, 227232556,
+  231238569, 235238055, 239230917, 243217063, 247196400, 251168835, 255134279, 259092643,
+  263043837, 266987774, 270924369, 274853536, 278775192, 282689253, 286595638, 290494267,
+  294385059, 298267937, 302142824, 306009643, 309868320, 313718782, 317560955, 321394768,
+  325220151, 329037035, 332845353, 336645037, 340436023, 344218245, 347991640, 351756148,
+  355511705, 359258254, 362995735, 366724092, 370443267, 374153206, 377853855, 381545162,
+  385227074, 388899541, 392562515, 396215946, 399859787, 403493994, 407118521, 410733324,
+  414338361, 417933591, 421518973, 425094468, 428660037, 432215645, 435761254, 439296830,
+  442822340, 446337750, 449843028, 453338145, 456823070, 460297774, 463762232, 467216414,
+  470660297, 474093856, 477517067, 480929907, 484332355, 487724391, 491105994, 494477146,
+  497837829, 501188027, 504527723, 507856902, 511175551, 514483656, 517781204, 521068185,
+  524344587, 527610402, 530865619, 534110231, 537344232, 540567613, 543780370, 546982499,
+  550173994, 553354853, 556525073, 559684652, 562833591, 565971887, 569099543, 572216558,
+  575322936, 578418678, 581503788, 584578271, 587642129, 590695370, 593737999, 596770023,
+  599791448, 602802283, 605802536, 608792216, 611771334, 614739898, 617697921, 620645413,
+  623582386, 626508854, 629424828, 632330323, 635225352, 638109930, 640984073, 643847795,
+  646701114, 649544044, 652376604, 655198810, 658010682, 660812236, 663603492, 666384468,
+  669155185, 671915663, 674665921, 677405981, 680135863, 682855589, 685565182, 688264663,
+  690954054, 693633380, 696302662, 698961924, 701611191, 704250487, 706879836, 709499262,
+  712108791, 714708448, 717298260, 719878250, 722448447, 725008876, 727559563, 730100536,
+  732631822, 735153448, 737665442, 740167831, 742660643, 745143906, 747617650, 750081902,
+  752536690, 754982045, 757417995, 759844569, 762261796, 764669707, 767068330, 769457696,
+  771837835, 774208776, 776570551, 778923188, 781266719, 783601175, 785926586, 788242982,
+  790550395, 792848855, 795138394, 797419043, 799690833, 801953796, 804207961, 806453363,
+  808690030, 810917996, 813137292, 815347949, 817549999, 819743474, 821928406, 824104826,
+  826272767, 828432260, 830583337, 832726030, 834860371, 836986393, 839104126, 841213603,
+  843314857
+};
+
+// sqrt(i/256) for i = 64..256 in Q31. Covers the normalized range [0.25,1].
+static const uint32_t ik_sqrt_table[193] = {
+  1073741824, 1082097918, 1090389977, 1098619452, 1106787739, 1114896182, 1122946079, 1130938678,
+  1138875187, 1146756771, 1154584553, 1162359621, 1170083026, 1177755783, 1185378878, 1192953261,
+  1200479854, 1207959552, 1215393219, 1222781696, 1230125796, 1237426310, 1244684005, 1251899625,
+  1259073893, 1266207514, 1273301169, 1280355523, 1287371222, 1294348895, 1301289153, 1308192592,
+  1315059792, 1321891318, 1328687719, 1335449532, 1342177280, 1348871473, 1355532607, 1362161168,
+  1368757628, 1375322451, 1381856086, 1388358974, 1394831545, 1401274219, 1407687407, 1414071510,
+  1420426919, 1426754019, 1433053185, 1439324782, 1445569171, 1451786701, 1457977717, 1464142555,
+  1470281545, 1476395008, 1482483261, 1488546612, 1494585366, 1500599818, 1506590260, 1512556978,
+  1518500250, 1524420351, 1530317551, 1536192112, 1542044294, 1547874349, 1553682529, 1559469076,
+  1565234231, 1570978229, 1576701302, 1582403676, 1588085574, 1593747216, 1599388817, 1605010588,
+  1610612736, 1616195466, 1621758978, 1627303469, 1632829134, 1638336161, 1643824740, 1649295054,
+  1654747284, 1660181608, 1665598202, 1670997238, 1676378885, 1681743312, 1687090681, 1692421154,
+  1697734891, 1703032049, 1708312781, 1713577240, 1718825574, 1724057932, 1729274458, 1734475296,
+  1739660585, 1744830464, 1749985070, 1755124538, 1760249000, 1765358587, 1770453428, 1775533649,
+  1780599376, 1785650732, 1790687838, 1795710816, 1800719782, 1805714853, 1810696145, 1815663770,
+  1820617842, 1825558469, 1830485761, 1835399826, 1840300769, 1845188694, 1850063706, 1854925906,
+  1859775393, 1864612269, 1869436629, 1874248572, 1879048192, 1883835584, 1888610840, 1893374053,
+  1898125312, 1902864709, 1907592330, 1912308264, 1917012597, 1921705413, 1926386797, 1931056833,
+  1935715602, 1940363185, 1944999662, 1949625114, 1954239618, 1958843251, 1963436090, 1968018211,
+  1972589688, 1977150595, 1981701005, 1986240991, 1990770623, 1995289972, 1999799107, 2004298098,
+  2008787014, 2013265920, 2017734884, 2022193972, 2026643249, 2031082780, 2035512628, 2039932856,
+  2044343526, 2048744702, 2053136442, 2057518809, 2061891861, 2066255659, 2070610259, 2074955721,
+  2079292101, 2083619457, 2087937844, 2092247318, 2096547933, 2100839745, 2105122807, 2109397173,
+  2113662894, 2117920024, 2122168614, 2126408716, 2130640379, 2134863654, 2139078592, 2143285240,
+  2147483648
+};
+
+// Returns the ratio a/b in Q32 for a <= b, b != 0. A 32-bit hardware UDIV by the top 16 bits of the
+// normalized divisor seeds its reciprocal, which one Newton-Raphson step refines to ~30 bits.
+static uint32_t ik_ratio_q32(uint32_t a, uint32_t b)
+{
+  uint8_t s = __builtin_clz(b);
+  a <<= s; b <<= s; // b in [2^31,2^32)
+  uint32_t r = (0xFFFFFFFFu/(b >> 16)) << 14; // 1/b in Q30, ~15 bits
+  uint32_t e = 0x80000000u - (uint32_t)(((uint64_t)b*r) >> 32); // 2 - b*r in Q30
+  r = (uint32_t)(((uint64_t)r*e) >> 30);
+  uint64_t q = ((uint64_t)a*r) >> 30;
+  return (q > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)q);
+}
+
+// Returns atan2(y,x) in Q28 radians. Octant folded onto the [0,1] range of the table.
+static int32_t ik_atan2_q28(int32_t y, int32_t x)
+{
+  uint32_t ax = (x < 0 ? -x : x);
+  uint32_t ay = (y < 0 ? -y : y);
+  if (ax == 0 && ay == 0) { return(0); }
+  uint32_t t = (ay <= ax ? ik_ratio_q32(ay, ax) : ik_ratio_q32(ax, ay));
+  uint8_t idx = t >> 24;
+  int32_t a0 = ik_atan_table[idx];
+  int32_t a = a0 + (int32_t)(((int64_t)(ik_atan_table[idx+1]-a0)*((t >> 8) & 0xFFFF)) >> 16);
+  if (ay > ax) { a = IK_PI_2_Q30 - a; }
+  a >>= 2; // Q30 -> Q28
+  if (x < 0) { a = IK_PI_Q28 - a; }
+  return (y < 0 ? -a : a);
+}
+
+// Returns sqrt(v) in Q30 of v in Q60. Normalized by an even shift into [0.25,1) for the table.
+static int32_t ik_sqrt_q30(uint64_t v)
+{
+  if (v == 0) { return(0); }
+  uint8_t e = __builtin_clzll(v) & ~1; // v <= 2^60, so e >= 2.
+  uint32_t m = (v << e) >> 32;
+  uint8_t idx = (m >> 24) - 64;
+  uint32_t s0 = ik_sqrt_table[idx];
+  uint32_t s = s0 + (uint32_t)(((uint64_t)(ik_sqrt_table[idx+1]-s0)*((m >> 8) & 0xFFFF)) >> 16);
+  return (int32_t)(s >> ((e >> 1)-1));
+}
+
+static void inverse_kinematics_fixed(float const *cartesian, float *f_scara, uint8_t elbow)
+{
+  int32_t pos_x = -IK_Q16(cartesian[X_AXIS]) - scara.offset_x_q16;
+  int32_t pos_y = IK_Q16(cartesian[Y_AXIS]) + scara.offset_y_q16;
+
+  // Elbow cosine by the law of cosines. Clamped to the reachable annulus.
+  int64_t num = (int64_t)pos_x*pos_x + (int64_t)pos_y*pos_y - scara.sum_sq_q32;
+  if (num > scara.two_l1l2_q32) { num = scara.two_l1l2_q32; }
+  else if (num < -scara.two_l1l2_q32) { num = -scara.two_l1l2_q32; }
+  int32_t c2 = (int32_t)(((num >> 16)*scara.inv_2l1l2_q46) >> 32);
+  int32_t s2 = ik_sqrt_q30(((uint64_t)1 << 60) - (uint64_t)((int64_t)c2*c2));
+  if (elbow == SCARA_ELBOW_LEFT) { s2 = -s2; }
+
+  int32_t k1 = scara.l1_q16 + (int32_t)(((int64_t)scara.l2_q16*c2) >> 30);
+  int32_t k2 = (int32_t)(((int64_t)scara.l2_q16*s2) >> 30);
+
+  // theta spans +/-2pi. Wrapped into +/-pi, so adding the elbow angle cannot overflow Q28. Both
+  // joints move by whole turns, which inverse_kinematics() unwraps.
+  int32_t theta = ik_atan2_q28(k1, k2) - ik_atan2_q28(pos_x, pos_y);
+  if (theta > IK_PI_Q28) { theta -= 2*IK_PI_Q28; }
+  else if (theta < -IK_PI_Q28) { theta += 2*IK_PI_Q28; }
+  int32_t psi = ik_atan2_q28(s2, c2) + theta;
+
+  f_scara[X_AXIS] = theta*IK_Q28_TO_DEGREES - scara.zero_theta;
+  f_scara[Y_AXIS] = psi*IK_Q28_TO_DEGREES - scara.zero_psi;
+  f_scara[Z_AXIS] = cartesian[Z_AXIS];
+}
+#endif
+
+static void inverse_kinematics_float(float const *cartesian, float *f_scara, uint8_t elbow)
 {
     float SCARA_pos[2];
 
     static float SCARA_C2, SCARA_S2, SCARA_K1, SCARA_K2, SCARA_theta, SCARA_psi;
 
-    SCARA_pos[X_AXIS] = -cartesian[X_AXIS] - SCARA_OFFSET_X;  //ϵXֵȡ
-    SCARA_pos[Y_AXIS] = cartesian[Y_AXIS] + SCARA_OFFSET_Y;  //ϵYֵ
+    SCARA_pos[X_AXIS] = -cartesian[X_AXIS] - scara.offset_x;  //ϵXֵȡ
+    SCARA_pos[Y_AXIS] = cartesian[Y_AXIS] + scara.offset_y;  //ϵYֵ
 
-    SCARA_C2 =   ( sq(SCARA_pos[X_AXIS]) + sq(SCARA_pos[Y_AXIS]) - L1_2 - L2_2 ) /(2*L1*L2);
+    SCARA_C2 =   ( sq(SCARA_pos[X_AXIS]) + sq(SCARA_pos[Y_AXIS]) - scara.sum_sq ) * scara.inv_2l1l2;
+    // Clamp rounding at the edge of the annulus. Unreachable targets are caught by scara_check_workspace().
+    if (SCARA_C2 > 1.0f) { SCARA_C2 = 1.0f; }
+    else if (SCARA_C2 < -1.0f) { SCARA_C2 = -1.0f; }
     SCARA_S2 = sqrtf( 1 - sq(SCARA_C2) );
+    if (elbow == SCARA_ELBOW_LEFT) { SCARA_S2 = -SCARA_S2; }
 
-    SCARA_K1 = SCARA_LINKAGE_1 + SCARA_LINKAGE_2 * SCARA_C2;
-    SCARA_K2 = SCARA_LINKAGE_2 * SCARA_S2;
+    SCARA_K1 = scara.l1 + scara.l2 * SCARA_C2;
+    SCARA_K2 = scara.l2 * SCARA_S2;
 
     SCARA_theta = ( atan2f(SCARA_K1, SCARA_K2)-atan2f(SCARA_pos[X_AXIS],SCARA_pos[Y_AXIS]) ) ;//תǶȣ-Xн
     SCARA_psi   =   atan2f(SCARA_S2,SCARA_C2) + SCARA_theta;//СתǶȣYСϵתǶʱʹô˹ʽ
-		
-		if(!angle_mode)
-		{
-				f_scara[X_AXIS] = DEGREES(SCARA_theta); //תǶתΪ
-				f_scara[Y_AXIS] = DEGREES(SCARA_psi);   //СתǶתΪ
-				f_scara[Z_AXIS] = cartesian[Z_AXIS];
-		}
-		else
-		{
-				f_scara[X_AXIS] = cartesian[X_AXIS]; 
-				f_scara[Y_AXIS] = cartesian[Y_AXIS]; 
-				f_scara[Z_AXIS] = cartesian[Z_AXIS];		
-		
-		}
+
+    f_scara[X_AXIS] = DEGREES(SCARA_theta) - scara.zero_theta; //תǶתΪ
+    f_scara[Y_AXIS] = DEGREES(SCARA_psi) - scara.zero_psi;   //СתǶתΪ
+    f_scara[Z_AXIS] = cartesian[Z_AXIS];
+}
+
+// Joint solution in the given elbow configuration, as returned by atan2. Not unwrapped.
+static void inverse_kinematics_elbow(float const *cartesian, float *f_scara, uint8_t elbow)
+{
+  #ifdef SCARA_FIXED_POINT_IK
+    inverse_kinematics_fixed(cartesian, f_scara, elbow);
+  #else
+    inverse_kinematics_float(cartesian, f_scara, elbow);
+  #endif
+}
+
+#ifdef STM32F103C8
+#define SCARA_IK_SAMPLES 16 // Points timed per kernel
+
+uint32_t scara_ik_cycles(uint32_t *fixed_cycles)
+{
+  // Points evenly around the base on the mid radius of the annulus, alternating elbow configurations.
+  float cartesian[SCARA_IK_SAMPLES][N_AXIS];
+  float joint[N_AXIS];
+  float radius = sqrtf(0.5f*(scara.min_r2 + scara.max_r2));
+  uint8_t i;
+  for (i=0; i<SCARA_IK_SAMPLES; i++) {
+    float angle = (2.0f*M_PI/SCARA_IK_SAMPLES)*i;
+    cartesian[i][X_AXIS] = -radius*cosf(angle) - scara.offset_x;
+    cartesian[i][Y_AXIS] = radius*sinf(angle) - scara.offset_y;
+    cartesian[i][Z_AXIS] = 0.0f;
+  }
+
+  uint32_t start, cycles = 0;
+  for (i=0; i<SCARA_IK_SAMPLES; i++) {
+    start = DWT_CYCCNT;
+    inverse_kinematics_float(cartesian[i], joint, i & 1);
+    cycles += DWT_CYCCNT - start;
+  }
+  *fixed_cycles = 0;
+  #ifdef SCARA_FIXED_POINT_IK
+    for (i=0; i<SCARA_IK_SAMPLES; i++) {
+      start = DWT_CYCCNT;
+      inverse_kinematics_fixed(cartesian[i], joint, i & 1);
+      *fixed_cycles += DWT_CYCCNT - start;
+    }
+    *fixed_cycles /= SCARA_IK_SAMPLES;
+  #endif
+  return(cycles/SCARA_IK_SAMPLES);
+}
+#endif
+
+uint8_t scara_elbow(float const *f_scara)
+{
+    if (sinf(RADIANS(f_scara[Y_AXIS]-f_scara[X_AXIS] + scara.zero_psi-scara.zero_theta)) < 0.0f) { return(SCARA_ELBOW_LEFT); }
+    return(SCARA_ELBOW_RIGHT);
+}
+
+void scara_unwrap(float *f_scara, float const *reference)
+{
+    uint8_t idx;
+    for (idx=X_AXIS; idx<=Y_AXIS; idx++) {
+      f_scara[idx] += 360.0f*lroundf((reference[idx]-f_scara[idx])*(1.0f/360.0f));
+    }
+}
+
+void inverse_kinematics(float const *cartesian, float *f_scara, float const *reference)
+{
+    uint8_t elbow = settings.scara_elbow;
+    if (elbow == SCARA_ELBOW_AUTO) { elbow = ((reference == NULL) ? SCARA_ELBOW_RIGHT : scara_elbow(reference)); }
+    float joint[N_AXIS]; // Solved locally, since reference may alias f_scara.
+    inverse_kinematics_elbow(cartesian, joint, elbow);
+    if (reference != NULL) { scara_unwrap(joint, reference); }
+    memcpy(f_scara, joint, sizeof(joint));
+}
+
+void inverse_kinematics_batch(float (*cartesian)[N_AXIS], float (*f_scara)[N_AXIS], uint8_t count, float const *reference)
+{
+    uint8_t elbow = settings.scara_elbow;
+    if (elbow == SCARA_ELBOW_AUTO) { elbow = scara_elbow(reference); }
+    uint8_t i;
+    for (i=0; i<count; i++) {
+      inverse_kinematics_elbow(cartesian[i], f_scara[i], elbow);
+      scara_unwrap(f_scara[i], reference);
+      reference = f_scara[i];
+    }
+}
+
+// Time to reach f_scara from reference, with both joints moving at their max rates. Infinite, if
+// f_scara is outside the joint limits.
+static float scara_joint_travel_time(float const *f_scara, float const *reference)
+{
+    if (scara_check_workspace(NULL, f_scara)) { return(SOME_LARGE_VALUE); }
+    return(max(fabsf(f_scara[X_AXIS]-reference[X_AXIS])/settings.max_rate[X_AXIS],
+               fabsf(f_scara[Y_AXIS]-reference[Y_AXIS])/settings.max_rate[Y_AXIS]));
+}
+
+void scara_inverse_kinematics_shortest(float const *cartesian, float *f_scara, float const *reference)
+{
+    float left[N_AXIS];
+    inverse_kinematics_elbow(cartesian, f_scara, SCARA_ELBOW_RIGHT);
+    scara_unwrap(f_scara, reference);
+    inverse_kinematics_elbow(cartesian, left, SCARA_ELBOW_LEFT);
+    scara_unwrap(left, reference);
+    if (scara_joint_travel_time(left, reference) < scara_joint_travel_time(f_scara, reference)) {
+      memcpy(f_scara, left, sizeof(left));
+    }
+}
+
+// Smallest |sin(theta-psi)| the incremental update runs at. Below it, the arm is within ~3 deg of
+// straight and the joint rates of a Cartesian step blow up, so the caller solves exactly instead.
+#define SCARA_JACOBIAN_MIN_SIN 0.05f
+
+void scara_jacobian_init(scara_jacobian_t *jac, float const *f_scara)
+{
+    jac->theta = RADIANS(f_scara[X_AXIS] + scara.zero_theta);
+    jac->psi = RADIANS(f_scara[Y_AXIS] + scara.zero_psi);
+    jac->sin_theta = sinf(jac->theta);
+    jac->cos_theta = cosf(jac->theta);
+    jac->sin_psi = sinf(jac->psi);
+    jac->cos_psi = cosf(jac->psi);
+}
+
+// Inverse of the SCARA Jacobian, from the forward kinematics X = -L1*cos(theta) - L2*cos(psi) and
+// Y = L1*sin(theta) + L2*sin(psi). Its determinant is L1*L2*sin(theta-psi). The joint step is taken
+// with the Jacobian at the midpoint of the step, and the sines and cosines are advanced with the same
+// small angle rotation as mc_arc(). No trig or libm calls.
+uint8_t scara_jacobian_step(scara_jacobian_t *jac, float const *delta, float *f_scara)
+{
+    float sin_d = jac->sin_theta*jac->cos_psi - jac->cos_theta*jac->sin_psi; // sin(theta-psi)
+    if (fabsf(sin_d) < SCARA_JACOBIAN_MIN_SIN) { return(false); }
+    float inv_d = 1.0f/sin_d;
+    float d_theta = (jac->cos_psi*delta[X_AXIS] - jac->sin_psi*delta[Y_AXIS])*inv_d*scara.inv_l1;
+    float d_psi = (jac->sin_theta*delta[Y_AXIS] - jac->cos_theta*delta[X_AXIS])*inv_d*scara.inv_l2;
+
+    // Re-evaluate at the half step. First order sin/cos advance is enough for a half step.
+    float sin_theta = jac->sin_theta + 0.5f*d_theta*jac->cos_theta;
+    float cos_theta = jac->cos_theta - 0.5f*d_theta*jac->sin_theta;
+    float sin_psi = jac->sin_psi + 0.5f*d_psi*jac->cos_psi;
+    float cos_psi = jac->cos_psi - 0.5f*d_psi*jac->sin_psi;
+    sin_d = sin_theta*cos_psi - cos_theta*sin_psi;
+    if (fabsf(sin_d) < SCARA_JACOBIAN_MIN_SIN) { return(false); }
+    inv_d = 1.0f/sin_d;
+    d_theta = (cos_psi*delta[X_AXIS] - sin_psi*delta[Y_AXIS])*inv_d*scara.inv_l1;
+    d_psi = (sin_theta*delta[Y_AXIS] - cos_theta*delta[X_AXIS])*inv_d*scara.inv_l2;
+
+    // Rotate sines and cosines by the joint step. cos(d) ~ 1-d^2/2, sin(d) ~ d.
+    float cos_T = 1.0f - 0.5f*d_theta*d_theta;
+    sin_theta = jac->sin_theta*cos_T + jac->cos_theta*d_theta;
+    jac->cos_theta = jac->cos_theta*cos_T - jac->sin_theta*d_theta;
+    jac->sin_theta = sin_theta;
+    cos_T = 1.0f - 0.5f*d_psi*d_psi;
+    sin_psi = jac->sin_psi*cos_T + jac->cos_psi*d_psi;
+    jac->cos_psi = jac->cos_psi*cos_T - jac->sin_psi*d_psi;
+    jac->sin_psi = sin_psi;
+
+    jac->theta += d_theta;
+    jac->psi += d_psi;
+    f_scara[X_AXIS] = DEGREES(jac->theta) - scara.zero_theta;
+    f_scara[Y_AXIS] = DEGREES(jac->psi) - scara.zero_psi;
+    f_scara[Z_AXIS] += delta[Z_AXIS];
+    return(true);
+}
+
+// Joint rates per mm of Cartesian travel from the inverse Jacobian, as in scara_jacobian_step(). Both
+// scale with 1/sin(theta-psi), the condition of the Jacobian, and grow without bound as the elbow
+// straightens or folds. Bounded here by MINIMUM_FEED_RATE, so the arm never stalls on the singularity.
+float scara_joint_rate_limit(scara_jacobian_t const *jac, float const *unit_vec)
+{
+    float sin_d = fabsf(jac->sin_theta*jac->cos_psi - jac->cos_theta*jac->sin_psi);
+    // Joint degrees per mm, times sin(theta-psi). Z is linear.
+    float rate[N_AXIS];
+    rate[X_AXIS] = DEGREES(fabsf(jac->cos_psi*unit_vec[X_AXIS] - jac->sin_psi*unit_vec[Y_AXIS])*scara.inv_l1);
+    rate[Y_AXIS] = DEGREES(fabsf(jac->sin_theta*unit_vec[Y_AXIS] - jac->cos_theta*unit_vec[X_AXIS])*scara.inv_l2);
+    rate[Z_AXIS] = fabsf(unit_vec[Z_AXIS]);
+    float scale[N_AXIS] = { sin_d, sin_d, 1.0f };
+    float limit = SOME_LARGE_VALUE;
+    uint8_t idx;
+    for (idx=0; idx<N_AXIS; idx++) {
+      // Multiplies by sin(theta-psi) rather than divide by it, since it may be zero.
+      if (rate[idx] > 0.0f) { limit = min(limit, scale[idx]*settings.max_rate[idx]/rate[idx]); }
+    }
+    return(max(limit, MINIMUM_FEED_RATE));
+}
+
+// Cheap enough to run on every segment: a squared radius against the cached annulus bounds and
+// four compares. Written so a NaN angle fails the joint check.
+uint8_t scara_check_workspace(float const *cartesian, float const *f_scara)
+{
+    if (cartesian != NULL) {
+        float pos_x = -cartesian[X_AXIS] - scara.offset_x;
+        float pos_y = cartesian[Y_AXIS] + scara.offset_y;
+        float r2 = pos_x*pos_x + pos_y*pos_y;
+        if ((r2 < scara.min_r2) || (r2 > scara.max_r2)) { return(EXEC_ALARM_WORKSPACE); }
+    }
+    if (bit_istrue(settings.flags,BITFLAG_SOFT_LIMIT_ENABLE)) {
+        uint8_t idx;
+        for (idx=X_AXIS; idx<=Y_AXIS; idx++) {
+            if (!((f_scara[idx] >= settings.scara_joint_min[idx]) && (f_scara[idx] <= settings.scara_joint_max[idx]))) {
+                return(EXEC_ALARM_SOFT_LIMIT);
+            }
+        }
+    }
+    return(0);
+}
+
+// Rotates a sine and cosine pair by a small angle d. sin(d) ~ d-d^3/6 and cos(d) ~ 1-d^2/2+d^4/24
+// are good to float precision within SCARA_REPORT_MAX_ROTATION.
+static void scara_rotate(float *sin_a, float *cos_a, float d)
+{
+    float d2 = d*d;
+    float sin_d = d*(1.0f - d2*(1.0f/6.0f));
+    float cos_d = 1.0f - 0.5f*d2*(1.0f - d2*(1.0f/12.0f));
+    float sin_r = (*sin_a)*cos_d + (*cos_a)*sin_d;
+    *cos_a = (*cos_a)*cos_d - (*sin_a)*sin_d;
+    *sin_a = sin_r;
+}
+
+void scara_report_position(float *position, int32_t *steps)
+{
+    if (memcmp(steps, report_cache.steps, sizeof(report_cache.steps)) || (report_cache.rotations >= SCARA_REPORT_RESYNC)) {
+        float d_theta = RADIANS((steps[X_AXIS]-report_cache.steps[X_AXIS])/settings.steps_per_mm[X_AXIS]);
+        float d_psi = RADIANS((steps[Y_AXIS]-report_cache.steps[Y_AXIS])/settings.steps_per_mm[Y_AXIS]);
+        scara_jacobian_t *pose = &report_cache.pose;
+        if ((report_cache.rotations < SCARA_REPORT_RESYNC) && (fabsf(d_theta) < SCARA_REPORT_MAX_ROTATION) &&
+            (fabsf(d_psi) < SCARA_REPORT_MAX_ROTATION)) {
+            scara_rotate(&pose->sin_theta, &pose->cos_theta, d_theta);
+            scara_rotate(&pose->sin_psi, &pose->cos_psi, d_psi);
+            pose->theta += d_theta;
+            pose->psi += d_psi;
+            report_cache.rotations++;
+        } else {
+            float joint[N_AXIS];
+            uint8_t idx;
+            for (idx=0; idx<N_AXIS; idx++) { joint[idx] = steps[idx]/settings.steps_per_mm[idx]; }
+            scara_jacobian_init(pose, joint);
+            report_cache.rotations = 0;
+        }
+        memcpy(report_cache.steps, steps, sizeof(report_cache.steps));
+        report_cache.position[X_AXIS] = -scara.l1*pose->cos_theta - scara.l2*pose->cos_psi - scara.offset_x;
+        report_cache.position[Y_AXIS] = scara.l1*pose->sin_theta + scara.l2*pose->sin_psi - scara.offset_y;
+        report_cache.position[Z_AXIS] = steps[Z_AXIS]/settings.steps_per_mm[Z_AXIS];
+    }
+    memcpy(position, report_cache.position, sizeof(report_cache.position));
 }
 
 void scara_report_positions() 
@@ -94,3 +526,4 @@ void scara_report_positions()
 
 }
 
+#endif
@@ -31,28 +31,104 @@
 #define IS_SCARA true
 #endif
 
-
-// Length of inner and outer support arms. Measure arm lengths precisely.
-#define SCARA_LINKAGE_1 200.0f //mm
-#define SCARA_LINKAGE_2 200.0f //mm
-
-// SCARA tower offset (position of Tower relative to bed zero position)
-// This needs to be reasonably accurate as it defines the printbed position in the SCARA space.
-#define SCARA_OFFSET_X -135 //mm
-#define SCARA_OFFSET_Y 105//mm	
-
-#define MANUAL_X_HOME_POS -45.43f
-#define MANUAL_Y_HOME_POS 95.67f
-#define MANUAL_Z_HOME_POS 0.0f
+// NOTE: Arm lengths, tower offset and home position are runtime settings $42-$48. See defaults.h.
 
 #define RADIANS(d) ((d)*(float)M_PI/180.0f)
 #define DEGREES(r) ((r)*180.0f/(float)M_PI)
 
 #define sq(x) x*x
 
-extern float ManualHomePos[3];
-void inverse_kinematics(float const *cartesian, float *f_scara);
+// Joint angles in radians and their sines and cosines, tracked by the incremental Jacobian update.
+typedef struct {
+  float theta, psi;
+  float sin_theta, cos_theta;
+  float sin_psi, cos_psi;
+} scara_jacobian_t;
+
+// Kinematics constants derived from the geometry settings. Cached by scara_init(), so the
+// kinematics hot paths do no divisions by arm lengths.
+// The tool frame, $57-$59, is folded into the outer arm: l2 and zero_psi are the length and angle of
+// the line from the elbow axis to the tool tip, so the kinematics below solve for the tip directly
+// and a tool change only re-computes these constants.
+typedef struct {
+  float l1, l2;          // Inner arm length, and elbow to tool tip length (mm)
+  float offset_x, offset_y; // Tower offset (mm)
+  float zero_theta, zero_psi; // Joint zero offsets (deg). Arm angle = motor angle + offset.
+  float tool_x, tool_y;  // Tool offset along and left of the outer arm, rotated by the wrist angle (mm)
+  float sum_sq;          // L1^2 + L2^2
+  float inv_2l1l2;       // 1/(2*L1*L2)
+  float inv_l1, inv_l2;  // 1/L1, 1/L2
+  float min_r2, max_r2;  // Squared inner and outer radius of the reachable annulus
+  #ifdef SCARA_FIXED_POINT_IK
+    int32_t l1_q16, l2_q16;
+    int32_t offset_x_q16, offset_y_q16;
+    int64_t sum_sq_q32, two_l1l2_q32, inv_2l1l2_q46;
+  #endif
+} scara_t;
+extern scara_t scara;
+
+// Re-computes the cached kinematics constants. Called upon reset and geometry setting changes.
+void scara_init();
+
+// Elbow configurations. Setting $54. Right-handed keeps the elbow angle psi-theta within [0,180]
+// degrees and left-handed within [-180,0]. Auto keeps the configuration the arm is in, and lets
+// rapids switch to whichever one is reached first.
+#define SCARA_ELBOW_RIGHT 0
+#define SCARA_ELBOW_LEFT  1
+#define SCARA_ELBOW_AUTO  2
+
+// Solves the joint angles of cartesian[N_AXIS] in the configured elbow configuration. If reference
+// is given, both joint angles are unwrapped by whole turns to the ones nearest to it, and it sets the
+// configuration in auto mode. Reference may be the same array as f_scara.
+void inverse_kinematics(float const *cartesian, float *f_scara, float const *reference);
+
+// Solves a batch of consecutive path points in one elbow configuration, the configured one or in auto
+// mode the one of reference. Each solution is unwrapped to the one before it, the first to reference.
+// Skips the per point configuration handling of inverse_kinematics().
+void inverse_kinematics_batch(float (*cartesian)[N_AXIS], float (*f_scara)[N_AXIS], uint8_t count, float const *reference);
+
+// Solves both elbow configurations, unwrapped to reference, and returns the one reached first from
+// reference with the joints at their max rates. Solutions outside the joint limits lose.
+void scara_inverse_kinematics_shortest(float const *cartesian, float *f_scara, float const *reference);
+
+#ifdef STM32F103C8
+  // Times the float inverse kinematics kernel with the DWT cycle counter on a fixed set of workspace
+  // points, and returns its mean CPU cycles per call, for $I. Sets fixed_cycles to the same for the
+  // fixed-point kernel, or zero if it is not compiled in.
+  uint32_t scara_ik_cycles(uint32_t *fixed_cycles);
+#endif
+
+// Returns the elbow configuration of joint angles f_scara[N_AXIS]. A straight arm is right-handed.
+uint8_t scara_elbow(float const *f_scara);
+
+// Shifts the joint angles in f_scara by whole turns to the ones nearest to reference.
+void scara_unwrap(float *f_scara, float const *reference);
+
 void forward_kinematics_SCARA(float const *f_scara, float *cartesian);
+
+// Returns the machine position of motor steps[N_AXIS] for status reports. Cached, and updated by an
+// incremental rotation while the joints have moved only a little since the last call.
+void scara_report_position(float *position, int32_t *steps);
 void scara_report_positions(void) ;
 
+// Checks a segment target against the arm workspace. Returns zero if valid, or the alarm to raise:
+// EXEC_ALARM_WORKSPACE if the Cartesian target is outside the reachable annulus, or, with soft limits
+// enabled, EXEC_ALARM_SOFT_LIMIT if a joint angle is outside its limits. Skips the reach check, if
+// cartesian is NULL.
+uint8_t scara_check_workspace(float const *cartesian, float const *f_scara);
+
+// NOTE: Joint angles f_scara[] are motor angles, as counted by the steppers from the homing switches.
+// The kinematics add the joint zero offsets $55/$56 to get the arm angles.
+
+// Loads the incremental Jacobian update with an exact joint solution f_scara[N_AXIS] in degrees.
+void scara_jacobian_init(scara_jacobian_t *jac, float const *f_scara);
+
+// Advances f_scara[N_AXIS] by the Cartesian step delta[N_AXIS] through the inverse Jacobian.
+// Returns false without updating, if the arm is too close to straight for a stable update.
+uint8_t scara_jacobian_step(scara_jacobian_t *jac, float const *delta, float *f_scara);
+
+// Returns the Cartesian rate (mm/min) along unit_vec[N_AXIS] at which the first joint reaches its
+// max rate, with the arm at the pose loaded in jac. Drops towards zero as the arm straightens.
+float scara_joint_rate_limit(scara_jacobian_t const *jac, float const *unit_vec);
+
 #endif
@@ -0,0 +1,236 @@
+/*
+  scara_calibration.c - SCARA kinematic calibration
+  Part of Grbl
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "grbl.h"
+
+#ifdef SCARA
+
+// Fitted parameters: arm lengths L1 and L2, tower offset X and Y, joint zero offsets theta and psi.
+#define CAL_N_PARAM 6
+#define CAL_MAX_ITERATIONS 10
+#define CAL_CONVERGED 1e-5f // Largest parameter step (mm) ending the iteration.
+#define CAL_MIN_PIVOT 1e-4f // Per point. Smaller pivots mean the points do not pin down every parameter.
+
+typedef struct {
+  float joint[2]; // Motor angles theta and psi (deg)
+  float world[2]; // Machine position X and Y (mm)
+} scara_cal_point_t;
+
+static scara_cal_point_t cal_point[N_SCARA_CALIBRATION_POINTS];
+static uint8_t cal_count = 0;
+
+
+// Solves a*x = b in place by Gaussian elimination with partial pivoting. Returns x in b, or false if
+// a is singular.
+static uint8_t cal_solve(float a[CAL_N_PARAM][CAL_N_PARAM], float *b)
+{
+  uint8_t i, j, k;
+  for (k=0; k<CAL_N_PARAM; k++) {
+    uint8_t pivot = k;
+    for (i=k+1; i<CAL_N_PARAM; i++) {
+      if (fabsf(a[i][k]) > fabsf(a[pivot][k])) { pivot = i; }
+    }
+    if (fabsf(a[pivot][k]) < CAL_MIN_PIVOT*cal_count) { return(false); }
+    if (pivot != k) {
+      float tmp;
+      for (j=k; j<CAL_N_PARAM; j++) { tmp = a[k][j]; a[k][j] = a[pivot][j]; a[pivot][j] = tmp; }
+      tmp = b[k]; b[k] = b[pivot]; b[pivot] = tmp;
+    }
+    for (i=k+1; i<CAL_N_PARAM; i++) {
+      float factor = a[i][k]/a[k][k];
+      for (j=k; j<CAL_N_PARAM; j++) { a[i][j] -= factor*a[k][j]; }
+      b[i] -= factor*b[k];
+    }
+  }
+  for (k=CAL_N_PARAM; k-- > 0; ) {
+    for (j=k+1; j<CAL_N_PARAM; j++) { b[k] -= a[k][j]*b[j]; }
+    b[k] /= a[k][k];
+  }
+  return(true);
+}
+
+
+// Residual of a point, measured minus modeled position, and its derivatives with respect to the
+// parameters. The model is forward_kinematics_SCARA(). The zero offset columns are scaled by the arm
+// lengths, so all parameter steps are in mm and the normal equations stay well conditioned in float.
+static void cal_residual(scara_cal_point_t *point, float *param, float *r, float *jx, float *jy)
+{
+  float theta = RADIANS(point->joint[0]) + param[4];
+  float psi = RADIANS(point->joint[1]) + param[5];
+  float sin_theta = sinf(theta), cos_theta = cosf(theta);
+  float sin_psi = sinf(psi), cos_psi = cosf(psi);
+  r[X_AXIS] = point->world[X_AXIS] - (-param[0]*cos_theta - param[1]*cos_psi - param[2]);
+  r[Y_AXIS] = point->world[Y_AXIS] - (param[0]*sin_theta + param[1]*sin_psi - param[3]);
+  jx[0] = -cos_theta; jx[1] = -cos_psi; jx[2] = -1.0f; jx[3] = 0.0f; jx[4] = sin_theta; jx[5] = sin_psi;
+  jy[0] = sin_theta;  jy[1] = sin_psi;  jy[2] = 0.0f;  jy[3] = -1.0f; jy[4] = cos_theta; jy[5] = cos_psi;
+}
+
+
+// Gauss-Newton least-squares fit, starting from the current geometry settings. Returns the RMS
+// position error of the fit in mm, or a negative value if it failed.
+static float cal_fit(float *param)
+{
+  float a[CAL_N_PARAM][CAL_N_PARAM], b[CAL_N_PARAM];
+  float r[2], jx[CAL_N_PARAM], jy[CAL_N_PARAM];
+  uint8_t iter, n, i, j;
+  for (iter=0; iter<CAL_MAX_ITERATIONS; iter++) {
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    for (n=0; n<cal_count; n++) {
+      cal_residual(&cal_point[n], param, r, jx, jy);
+      for (i=0; i<CAL_N_PARAM; i++) {
+        for (j=0; j<CAL_N_PARAM; j++) { a[i][j] += jx[i]*jx[j] + jy[i]*jy[j]; }
+        b[i] += jx[i]*r[X_AXIS] + jy[i]*r[Y_AXIS];
+      }
+    }
+    if (!cal_solve(a, b)) { return(-1.0f); }
+    b[4] /= param[0]; // Scale zero offset steps back to radians.
+    b[5] /= param[1];
+    float step = 0.0f;
+    for (i=0; i<CAL_N_PARAM; i++) {
+      param[i] += b[i];
+      step = max(step, fabsf(b[i]));
+    }
+    if (!((param[0] > 0.0f) && (param[1] > 0.0f))) { return(-1.0f); } // Also catches NaN.
+    if (step < CAL_CONVERGED) { break; }
+  }
+  float sum_sq = 0.0f;
+  for (n=0; n<cal_count; n++) {
+    cal_residual(&cal_point[n], param, r, jx, jy);
+    sum_sq += r[X_AXIS]*r[X_AXIS] + r[Y_AXIS]*r[Y_AXIS];
+  }
+  return(sqrtf(sum_sq/cal_count));
+}
+
+
+static uint8_t cal_compute()
+{
+  if (cal_count < SCARA_CALIBRATION_MIN_POINTS) { return(STATUS_CALIBRATION_FAILED); }
+  // The points locate the mounted tool, so the outer arm is fitted as the elbow to tool tip line of
+  // scara_init(), then taken back out of the tool frame.
+  float param[CAL_N_PARAM] = {
+    scara.l1, scara.l2, scara.offset_x, scara.offset_y,
+    RADIANS(scara.zero_theta), RADIANS(scara.zero_psi) };
+  float rms = cal_fit(param);
+  if (rms < 0.0f) { return(STATUS_CALIBRATION_FAILED); }
+  float arm_x = param[1]*param[1] - scara.tool_y*scara.tool_y;
+  if (!(arm_x > 0.0f)) { return(STATUS_CALIBRATION_FAILED); }
+  arm_x = sqrtf(arm_x);
+  float linkage = arm_x - scara.tool_x;
+  if (!(linkage > 0.0f)) { return(STATUS_CALIBRATION_FAILED); }
+
+  settings.scara_linkage[0] = param[0];
+  settings.scara_linkage[1] = linkage;
+  settings.scara_offset[X_AXIS] = param[2];
+  settings.scara_offset[Y_AXIS] = param[3];
+  settings.scara_joint_offset[X_AXIS] = DEGREES(param[4]);
+  settings.scara_joint_offset[Y_AXIS] = DEGREES(param[5] + atan2f(scara.tool_y, arm_x));
+  write_global_settings();
+  scara_init();
+  // The motor angles are unchanged, but the machine position they map to has moved.
+  plan_sync_position();
+  gc_sync_position();
+
+  printPgmString(PSTR("[CAL:"));
+  printFloat(settings.scara_linkage[0], N_DECIMAL_SETTINGVALUE);
+  serial_write(',');
+  printFloat(settings.scara_linkage[1], N_DECIMAL_SETTINGVALUE);
+  serial_write(',');
+  printFloat(settings.scara_offset[X_AXIS], N_DECIMAL_SETTINGVALUE);
+  serial_write(',');
+  printFloat(settings.scara_offset[Y_AXIS], N_DECIMAL_SETTINGVALUE);
+  serial_write(',');
+  printFloat(settings.scara_joint_offset[X_AXIS], N_DECIMAL_SETTINGVALUE);
+  serial_write(',');
+  printFloat(settings.scara_joint_offset[Y_AXIS], N_DECIMAL_SETTINGVALUE);
+  serial_write(':');
+  printFloat(rms, N_DECIMAL_SETTINGVALUE);
+  printPgmString(PSTR("]\r\n"));
+  return(STATUS_OK);
+}
+
+
+static uint8_t cal_record(char *line, uint8_t char_counter, uint8_t from_probe)
+{
+  if (line[char_counter++] != '=') { return(STATUS_INVALID_STATEMENT); }
+  scara_cal_point_t point;
+  uint8_t words = 0;
+  float value;
+  while (line[char_counter] != 0) {
+    char letter = line[char_counter++];
+    if (!read_float(line, &char_counter, &value)) { return(STATUS_BAD_NUMBER_FORMAT); }
+    switch (letter) {
+      case 'X': point.world[X_AXIS] = value; words |= bit(0); break;
+      case 'Y': point.world[Y_AXIS] = value; words |= bit(1); break;
+      case 'A': point.joint[X_AXIS] = value; words |= bit(2); break;
+      case 'B': point.joint[Y_AXIS] = value; words |= bit(3); break;
+      default: return(STATUS_INVALID_STATEMENT);
+    }
+  }
+  if ((words & (bit(0)|bit(1))) != (bit(0)|bit(1))) { return(STATUS_INVALID_STATEMENT); }
+  if (words & (bit(2)|bit(3))) {
+    if (from_probe || ((words & (bit(2)|bit(3))) != (bit(2)|bit(3)))) { return(STATUS_INVALID_STATEMENT); }
+  } else {
+    int32_t *steps = sys_position;
+    if (from_probe) {
+      if (!sys.probe_succeeded) { return(STATUS_CALIBRATION_FAILED); }
+      steps = sys_probe_position;
+    }
+    point.joint[X_AXIS] = system_convert_axis_steps_to_mpos(steps, X_AXIS);
+    point.joint[Y_AXIS] = system_convert_axis_steps_to_mpos(steps, Y_AXIS);
+  }
+  if (cal_count >= N_SCARA_CALIBRATION_POINTS) { return(STATUS_CALIBRATION_FAILED); }
+  memcpy(&cal_point[cal_count++], &point, sizeof(point));
+  return(STATUS_OK);
+}
+
+
+uint8_t scara_calibration_execute_line(char *line)
+{
+  uint8_t n;
+  switch (line[2]) {
+    case 0 : // List recorded points
+      for (n=0; n<cal_count; n++) {
+        printPgmString(PSTR("[CAL"));
+        print_uint8_base10(n+1);
+        serial_write(':');
+        printFloat(cal_point[n].world[X_AXIS], N_DECIMAL_SETTINGVALUE);
+        serial_write(',');
+        printFloat(cal_point[n].world[Y_AXIS], N_DECIMAL_SETTINGVALUE);
+        serial_write(':');
+        printFloat(cal_point[n].joint[X_AXIS], N_DECIMAL_SETTINGVALUE);
+        serial_write(',');
+        printFloat(cal_point[n].joint[Y_AXIS], N_DECIMAL_SETTINGVALUE);
+        printPgmString(PSTR("]\r\n"));
+      }
+      break;
+    case 'X' : // Clear recorded points
+      if (line[3] != 0) { return(STATUS_INVALID_STATEMENT); }
+      cal_count = 0;
+      break;
+    case 'C' : // Fit and store geometry
+      if (line[3] != 0) { return(STATUS_INVALID_STATEMENT); }
+      return(cal_compute());
+    case 'P' : return(cal_record(line, 3, true));
+    case '=' : return(cal_record(line, 2, false));
+    default : return(STATUS_INVALID_STATEMENT);
+  }
+  return(STATUS_OK);
+}
+
+#endif
@@ -0,0 +1,34 @@
+/*
+  scara_calibration.h - SCARA kinematic calibration
+  Part of Grbl
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef scara_calibration_h
+#define scara_calibration_h
+
+
+// Executes a $K calibration command. Points pair the motor angles of the arm with the known machine
+// XY position of a fiducial or probed feature. Then a least-squares fit of the arm lengths, tower
+// offset and joint zero offsets is stored as settings $42-$45 and $55-$56.
+//   $K                   Lists the recorded points.
+//   $K=X<x>Y<y>          Records the current arm pose, jogged onto the feature at X,Y.
+//   $K=X<x>Y<y>A<t>B<p>  Records user-entered motor angles A (theta) and B (psi) in degrees.
+//   $KP=X<x>Y<y>         Records the arm pose of the last successful G38 probe.
+//   $KC                  Fits, stores and reports the geometry.
+//   $KX                  Clears the recorded points.
+uint8_t scara_calibration_execute_line(char *line);
+
+#endif
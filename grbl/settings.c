@@ -88,6 +88,33 @@ void settings_restore(uint8_t restore_flag) {
     settings.homing_debounce_delay = DEFAULT_HOMING_DEBOUNCE_DELAY;
     settings.homing_pulloff = DEFAULT_HOMING_PULLOFF;
 
+#ifdef SCARA
+    settings.scara_segments_per_second = DEFAULT_SCARA_SEGMENTS_PER_SECOND;
+    settings.scara_chordal_tolerance = DEFAULT_SCARA_CHORDAL_TOLERANCE;
+    settings.scara_linkage[0] = DEFAULT_SCARA_LINKAGE_1;
+    settings.scara_linkage[1] = DEFAULT_SCARA_LINKAGE_2;
+    settings.scara_offset[X_AXIS] = DEFAULT_SCARA_OFFSET_X;
+    settings.scara_offset[Y_AXIS] = DEFAULT_SCARA_OFFSET_Y;
+    settings.scara_home_pos[X_AXIS] = DEFAULT_SCARA_HOME_POS_X;
+    settings.scara_home_pos[Y_AXIS] = DEFAULT_SCARA_HOME_POS_Y;
+    settings.scara_home_pos[Z_AXIS] = DEFAULT_SCARA_HOME_POS_Z;
+    settings.scara_joint_min[X_AXIS] = DEFAULT_SCARA_X_JOINT_MIN;
+    settings.scara_joint_max[X_AXIS] = DEFAULT_SCARA_X_JOINT_MAX;
+    settings.scara_joint_min[Y_AXIS] = DEFAULT_SCARA_Y_JOINT_MIN;
+    settings.scara_joint_max[Y_AXIS] = DEFAULT_SCARA_Y_JOINT_MAX;
+    settings.scara_elbow = DEFAULT_SCARA_ELBOW;
+    settings.scara_joint_offset[X_AXIS] = DEFAULT_SCARA_X_JOINT_OFFSET;
+    settings.scara_joint_offset[Y_AXIS] = DEFAULT_SCARA_Y_JOINT_OFFSET;
+    settings.scara_tool_offset[X_AXIS] = DEFAULT_SCARA_TOOL_OFFSET_X;
+    settings.scara_tool_offset[Y_AXIS] = DEFAULT_SCARA_TOOL_OFFSET_Y;
+    settings.scara_tool_wrist = DEFAULT_SCARA_TOOL_WRIST;
+#endif
+#ifdef INPUT_SHAPING
+    settings.shaper_type = DEFAULT_SHAPER_TYPE;
+    settings.shaper_frequency = DEFAULT_SHAPER_FREQUENCY;
+    settings.shaper_damping = DEFAULT_SHAPER_DAMPING;
+#endif
+
     settings.flags = 0;
     if (DEFAULT_REPORT_INCHES) { settings.flags |= BITFLAG_REPORT_INCHES; }
     if (DEFAULT_LASER_MODE) { settings.flags |= BITFLAG_LASER_MODE; }
@@ -110,6 +137,11 @@ void settings_restore(uint8_t restore_flag) {
     settings.max_travel[X_AXIS] = (-DEFAULT_X_MAX_TRAVEL);
     settings.max_travel[Y_AXIS] = (-DEFAULT_Y_MAX_TRAVEL);
     settings.max_travel[Z_AXIS] = (-DEFAULT_Z_MAX_TRAVEL);
+    #ifdef S_CURVE_ACCELERATION
+      settings.jerk[X_AXIS] = DEFAULT_X_JERK;
+      settings.jerk[Y_AXIS] = DEFAULT_Y_JERK;
+      settings.jerk[Z_AXIS] = DEFAULT_Z_JERK;
+    #endif
 
     write_global_settings();
   }
@@ -200,7 +232,18 @@ uint8_t read_global_settings() {
 
 // A helper method to set settings from command line
 uint8_t settings_store_global_setting(uint8_t parameter, float value) {
-  if (value < 0.0f) { return(STATUS_NEGATIVE_VALUE); }
+  if (value < 0.0f) {
+    #ifdef SCARA
+      // SCARA tower offsets, home positions, joint limits, zero offsets and the tool frame ($44-$48,
+      // $50-$53, $55-$59) are signed.
+      if (!(((parameter >= 44) && (parameter <= 48)) || ((parameter >= 50) && (parameter <= 53)) ||
+            ((parameter >= 55) && (parameter <= 59)))) {
+        return(STATUS_NEGATIVE_VALUE);
+      }
+    #else
+      return(STATUS_NEGATIVE_VALUE);
+    #endif
+  }
   if (parameter >= AXIS_SETTINGS_START_VAL) {
     // Store axis configuration. Axis numbering sequence set by AXIS_SETTING defines.
     // NOTE: Ensure the setting index corresponds to the report.c settings printout.
@@ -215,6 +258,9 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
             if (value*settings.max_rate[parameter] >(MAX_STEP_RATE_HZ*60.0f)) { return(STATUS_MAX_STEP_RATE_EXCEEDED); }
             #endif
             settings.steps_per_mm[parameter] = value;
+            #ifdef IS_SCARA
+              scara_init(); // Drops the cached status report position.
+            #endif
             break;
           case 1:
             #ifdef MAX_STEP_RATE_HZ
@@ -224,6 +270,9 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
             break;
           case 2: settings.acceleration[parameter] = value*60*60; break; // Convert to mm/min^2 for grbl internal use.
           case 3: settings.max_travel[parameter] = -value; break;  // Store as negative for grbl internal use.
+          #ifdef S_CURVE_ACCELERATION
+            case 4: settings.jerk[parameter] = value*60*60*60; break; // Convert to mm/min^3 for grbl internal use.
+          #endif
         }
         break; // Exit while-loop after setting has been configured and proceed to the EEPROM write call.
       } else {
@@ -308,6 +357,67 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
 				return(STATUS_SETTING_DISABLED_LASER);
         #endif
         break;
+#ifdef INPUT_SHAPING
+      case 36: case 37: case 38: { // Input shaper. Undone, if the settings do not give a shaper.
+        uint8_t previous_type = settings.shaper_type;
+        float previous_frequency = settings.shaper_frequency;
+        float previous_damping = settings.shaper_damping;
+        if (parameter == 36) { settings.shaper_type = int_value; }
+        else if (parameter == 37) { settings.shaper_frequency = value; }
+        else { settings.shaper_damping = value; }
+        if (!st_shaper_init()) {
+          settings.shaper_type = previous_type;
+          settings.shaper_frequency = previous_frequency;
+          settings.shaper_damping = previous_damping;
+          st_shaper_init();
+          return(STATUS_INVALID_STATEMENT);
+        }
+        break;
+      }
+#endif
+#ifdef SCARA
+      case 40: settings.scara_segments_per_second = value; break;
+      case 41: settings.scara_chordal_tolerance = value; break;
+      case 42: case 43: case 44: case 45: case 55: case 56: case 57: case 58: case 59: {
+        // Geometry or tool change. Re-initialize kinematics constants. Arm lengths must be non-zero.
+        float *geometry;
+        if (parameter <= 43) {
+          if (value == 0.0f) { return(STATUS_INVALID_STATEMENT); }
+          geometry = &settings.scara_linkage[parameter-42];
+        }
+        else if (parameter <= 45) { geometry = &settings.scara_offset[parameter-44]; }
+        else if (parameter <= 56) { geometry = &settings.scara_joint_offset[parameter-55]; }
+        else if (parameter == 59) { geometry = &settings.scara_tool_wrist; }
+        else { geometry = &settings.scara_tool_offset[parameter-57]; }
+        float previous = *geometry;
+        *geometry = value;
+        scara_init();
+        if (!(scara.l2 > 0.0f)) { // Tool tip on or behind the elbow axis. Undo.
+          *geometry = previous;
+          scara_init();
+          return(STATUS_INVALID_STATEMENT);
+        }
+        // The motor angles are unchanged, but the tool tip they map to has moved.
+        plan_sync_position();
+        gc_sync_position();
+        break;
+      }
+      case 46: case 47: case 48: settings.scara_home_pos[parameter-46] = value; break;
+      case 50: case 51: case 52: case 53: { // Joint limits. Each joint keeps its minimum below its maximum.
+        uint8_t joint = (parameter-50) >> 1;
+        if (parameter & 1) {
+          if (!(value > settings.scara_joint_min[joint])) { return(STATUS_INVALID_STATEMENT); }
+          settings.scara_joint_max[joint] = value;
+        } else {
+          if (!(value < settings.scara_joint_max[joint])) { return(STATUS_INVALID_STATEMENT); }
+          settings.scara_joint_min[joint] = value;
+        }
+        break;
+      }
+      case 54:
+        if (int_value > SCARA_ELBOW_AUTO) { return(STATUS_INVALID_STATEMENT); }
+        settings.scara_elbow = int_value; break;
+#endif
       default:
         return(STATUS_INVALID_STATEMENT);
     }
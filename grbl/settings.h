@@ -27,7 +27,7 @@
 
 // Version of the EEPROM data. Will be used to migrate existing data from older versions of Grbl
 // when firmware is upgraded. Always stored in byte 0 of eeprom
-#define SETTINGS_VERSION 10  // NOTE: Check settings_reset() when moving to next version.
+#define SETTINGS_VERSION 16  // NOTE: Check settings_reset() when moving to next version.
 
 // Define bit flag masks for the boolean settings in settings.flag.
 #define BITFLAG_REPORT_INCHES      bit(0)
@@ -70,7 +70,11 @@
 // #define SETTING_INDEX_G92    N_COORDINATE_SYSTEM+2  // Coordinate offset (G92.2,G92.3 not supported)
 
 // Define Grbl axis settings numbering scheme. Starts at START_VAL, every INCREMENT, over N_SETTINGS.
-#define AXIS_N_SETTINGS          4
+#ifdef S_CURVE_ACCELERATION
+  #define AXIS_N_SETTINGS        5
+#else
+  #define AXIS_N_SETTINGS        4
+#endif
 #define AXIS_SETTINGS_START_VAL  100 // NOTE: Reserving settings values >= 100 for axis settings. Up to 255.
 #define AXIS_SETTINGS_INCREMENT  10  // Must be greater than the number of axis settings
 
@@ -104,9 +108,34 @@ typedef struct {
   float homing_seek_rate;
   uint16_t homing_debounce_delay;
   float homing_pulloff;
+
+#ifdef SCARA
+  float scara_segments_per_second; // Cartesian line segmentation rate. Zero disables time-based split.
+  float scara_chordal_tolerance; // Max path deviation of a joint interpolated segment in mm.
+  float scara_linkage[2]; // Inner and outer arm lengths in mm.
+  float scara_offset[2]; // Tower position relative to the bed zero position. X and Y in mm.
+  float scara_home_pos[N_AXIS]; // Machine position at the homing switches. Joint degrees and Z mm.
+  float scara_joint_min[2]; // Joint soft limits in degrees. Inner and outer arm.
+  float scara_joint_max[2];
+  uint8_t scara_elbow; // Elbow configuration. See SCARA_ELBOW_* in scara.h.
+  float scara_joint_offset[2]; // Joint zero offsets in degrees. Identified by the $K calibration.
+  float scara_tool_offset[2]; // Tool tip along and left of the outer arm in mm. Set on tool changes.
+  float scara_tool_wrist; // Tool offset rotation in degrees, for tools mounted at an angle.
+#endif
+#ifdef S_CURVE_ACCELERATION
+  float jerk[N_AXIS]; // Axis jerk limits in mm/min^3. Zero does not limit the axis.
+#endif
+#ifdef INPUT_SHAPING
+  uint8_t shaper_type; // SHAPER_OFF, SHAPER_ZV or SHAPER_ZVD. See stepper.h.
+  float shaper_frequency; // Resonance frequency in Hz.
+  float shaper_damping; // Resonance damping ratio, from 0 up to but not including 1.
+#endif
 } settings_t;
 extern settings_t settings;
 
+// Writes the current global settings to EEPROM
+void write_global_settings();
+
 // Initialize the configuration subsystem (load settings from EEPROM)
 void settings_init();
 
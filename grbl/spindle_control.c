@@ -344,6 +344,9 @@ void spindle_stop()
   void spindle_sync(uint8_t state, float rpm)
   {
     if (sys.state == STATE_CHECK_MODE) { return; }
+    #ifdef TEACH_AND_REPLAY
+      if (teach_record_command(TEACH_RECORD_SPINDLE, state, rpm)) { return; }
+    #endif
     protocol_buffer_synchronize(); // Empty planner buffer to ensure spindle is set when programmed.
     spindle_set_state(state,rpm);
   }
@@ -351,6 +354,9 @@ void spindle_stop()
   void _spindle_sync(uint8_t state)
   {
     if (sys.state == STATE_CHECK_MODE) { return; }
+    #ifdef TEACH_AND_REPLAY
+      if (teach_record_command(TEACH_RECORD_SPINDLE, state, 0.0f)) { return; }
+    #endif
     protocol_buffer_synchronize(); // Empty planner buffer to ensure spindle is set when programmed.
     _spindle_set_state(state);
   }
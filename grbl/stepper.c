@@ -26,12 +26,21 @@ typedef int bool;
 #include "stm32f10x_rcc.h"
 #include "stm32f10x_tim.h"
 #include "misc.h"
+#ifdef STEP_DMA_BSRR
+#include "stm32f10x_dma.h"
+#endif
 void TIM_Configuration(TIM_TypeDef* TIMER, u16 Period, u16 Prescaler, u8 PP);
 #endif
 
 
 // Some useful constants.
 #define DT_SEGMENT (1.0f/(ACCELERATION_TICKS_PER_SECOND*60.0f)) // min/segment
+#define DT_SEGMENT_CRUISE (1.0f/(CRUISE_TICKS_PER_SECOND*60.0f)) // min/segment. Longest cruising segment.
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+  #define SEGMENT_MAX_STEPS (0xFFFF >> MAX_AMASS_LEVEL) // n_step is 16 bits, after the AMASS scaling.
+#else
+  #define SEGMENT_MAX_STEPS 0xFFFF
+#endif
 #define REQ_MM_INCREMENT_SCALAR 1.25f
 #define RAMP_ACCEL 0
 #define RAMP_CRUISE 1
@@ -42,6 +51,23 @@ void TIM_Configuration(TIM_TypeDef* TIMER, u16 Period, u16 Prescaler, u8 PP);
 #define PREP_FLAG_HOLD_PARTIAL_BLOCK bit(1)
 #define PREP_FLAG_PARKING bit(2)
 #define PREP_FLAG_DECEL_OVERRIDE bit(3)
+
+#ifdef INPUT_SHAPING
+  #define SHAPER_MAX_IMPULSES 3
+  // Longest shaper. The buffer holds the segments of the shaper duration behind the output, and as
+  // many held back ahead of it, at full DT_SEGMENT length.
+  #define SHAPER_MAX_DELAY ((SHAPER_BUFFER_SIZE/2)*DT_SEGMENT)
+
+  // Shaper output modes, by what is known of the commanded motion past the queued segments.
+  #define SHAPER_WAIT 0        // It goes on, but is not prepped yet.
+  #define SHAPER_STOP 1        // It stops at the end of the queued segments.
+  #define SHAPER_EXTRAPOLATE 2 // Buffer full. It is taken to go on at the last speed.
+#endif
+
+#ifdef S_CURVE_ACCELERATION
+  #define S_CURVE_BISECTIONS 16 // Time resolution of a ramp end, 1/65536 of the segment time.
+  #define S_CURVE_TOLERANCE 1e-4f // Relative. Float round-off allowed in checking a ramp against the plan.
+#endif
 const PORTPINDEF step_pin_mask[N_AXIS] =
 {
 	1 << X_STEP_BIT,
@@ -69,14 +95,21 @@ const PORTPINDEF limit_pin_mask[N_AXIS] =
 // timer, and the CPU overhead. Level 0 (no AMASS, normal operation) frequency bin starts at the
 // Level 1 cutoff frequency and up to as fast as the CPU allows (over 30kHz in limited testing).
 // NOTE: AMASS cutoff frequency multiplied by ISR overdrive factor must not exceed maximum step frequency.
-// NOTE: Current settings are set to overdrive the ISR to no more than 16kHz, balancing CPU overhead
-// and timer accuracy.  Do not alter these settings unless you know what you are doing.
+// NOTE: Current settings are set to overdrive the ISR to no more than AMASS_MAX_ISR_FREQUENCY, balancing
+// CPU overhead and timer accuracy. The AVR runs 16kHz. The 72MHz STM32 runs the ISR in a fraction of
+// the cycles and counts ticks at full clock, so it affords twice the rate and cutoff frequencies.
+// Do not alter these settings unless you know what you are doing.
 #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
 	#define MAX_AMASS_LEVEL 3
+  #ifdef STM32F103C8
+    #define AMASS_MAX_ISR_FREQUENCY 32000 // Hz
+  #else
+    #define AMASS_MAX_ISR_FREQUENCY 16000 // Hz
+  #endif
 	// AMASS_LEVEL0: Normal operation. No AMASS. No upper cutoff frequency. Starts at LEVEL1 cutoff frequency.
-	#define AMASS_LEVEL1 (F_CPU/8000) // Over-drives ISR (x2). Defined as F_CPU/(Cutoff frequency in Hz)
-	#define AMASS_LEVEL2 (F_CPU/4000) // Over-drives ISR (x4)
-	#define AMASS_LEVEL3 (F_CPU/2000) // Over-drives ISR (x8)
+	#define AMASS_LEVEL1 (F_CPU/(AMASS_MAX_ISR_FREQUENCY/2)) // Over-drives ISR (x2). Defined as F_CPU/(Cutoff frequency in Hz)
+	#define AMASS_LEVEL2 (F_CPU/(AMASS_MAX_ISR_FREQUENCY/4)) // Over-drives ISR (x4)
+	#define AMASS_LEVEL3 (F_CPU/(AMASS_MAX_ISR_FREQUENCY/8)) // Over-drives ISR (x8)
 
   #if MAX_AMASS_LEVEL <= 0
     error "AMASS must have 1 or more levels to operate correctly."
@@ -87,7 +120,8 @@ const PORTPINDEF limit_pin_mask[N_AXIS] =
 
 // Stores the planner block Bresenham algorithm execution data for the segments in the segment
 // buffer. Normally, this buffer is partially in-use, but, for the worst case scenario, it will
-// never exceed the number of accessible stepper buffer segments (SEGMENT_BUFFER_SIZE-1).
+// never exceed the number of accessible stepper buffer segments (SEGMENT_BUFFER_SIZE-1). The input
+// shaper holds back prepped segments too, which may each be of another block.
 // NOTE: This data is copied from the prepped planner blocks so that the planner blocks may be
 // discarded when entirely consumed and completed by the segment buffer. Also, AMASS alters this
 // data for its own use.
@@ -99,7 +133,12 @@ typedef struct {
     uint8_t is_pwm_rate_adjusted; // Tracks motions that require constant laser power/rate
   #endif
 } st_block_t;
-static st_block_t st_block_buffer[SEGMENT_BUFFER_SIZE-1];
+#ifdef INPUT_SHAPING
+  #define ST_BLOCK_BUFFER_SIZE (SEGMENT_BUFFER_SIZE+SHAPER_BUFFER_SIZE-2)
+#else
+  #define ST_BLOCK_BUFFER_SIZE (SEGMENT_BUFFER_SIZE-1)
+#endif
+static st_block_t st_block_buffer[ST_BLOCK_BUFFER_SIZE];
 
 // Primary stepper segment ring buffer. Contains small, short line segments for the stepper
 // algorithm to execute, which are "checked-out" incrementally from the first block in the
@@ -111,7 +150,10 @@ typedef struct {
   uint8_t  st_block_index;   // Stepper block data index. Uses this information to execute this segment.
   #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
     uint8_t amass_level;    // Indicates AMASS level for the ISR to execute this segment
-  #else
+  #endif
+  #ifdef STM32F103C8
+    uint8_t prescaler;      // Power of two timer prescaler for slow segments, with or without AMASS.
+  #elif !defined(ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING)
     uint8_t prescaler;      // Without AMASS, a prescaler is required to adjust for slow timing.
   #endif
   #ifdef VARIABLE_SPINDLE
@@ -131,7 +173,11 @@ typedef struct {
   #endif
 
   uint8_t execute_step;     // Flags step execution for each interrupt.
+#ifdef STM32F103C8
+  uint16_t step_pulse_time; // Step pulse reset time after step rise, in timer ticks
+#else
   uint8_t step_pulse_time;  // Step pulse reset time after step rise
+#endif
   PORTPINDEF step_outbits;         // The next stepping-bits to be output
   PORTPINDEF dir_outbits;
   #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
@@ -139,6 +185,7 @@ typedef struct {
   #endif
 
   uint16_t step_count;       // Steps remaining in line segment motion
+  uint16_t segment_steps[N_AXIS]; // Steps taken by each axis in the executing segment, not yet in sys_position
   uint8_t exec_block_index; // Tracks the current st_block index. Change indicates new block.
   st_block_t *exec_block;   // Pointer to the block data for the segment being executed
   segment_t *exec_segment;  // Pointer to the segment being executed
@@ -157,6 +204,116 @@ static PORTPINDEF dir_port_invert_mask;
 // Used to avoid ISR nesting of the "Stepper Driver Interrupt". Should never occur though.
 static volatile uint8_t busy;
 
+#ifdef STM32F103C8
+  // Returns the BSRR word that drives the 'pins' to the levels of the same bits in 'levels'. A BSRR
+  // write sets and resets pins atomically, without a read-modify-write of the rest of the port.
+  static inline uint32_t st_bsrr(PORTPINDEF pins, PORTPINDEF levels)
+  {
+    return( (pins & levels) | ((uint32_t)(pins & ~levels) << 16) );
+  }
+#endif
+
+#ifdef STM32F103C8
+  #define STEP_TIMER_MAX_PRESCALER 15 // Largest power of two TIM2 prescaler. TIM2->PSC is 16 bits.
+
+  // Worst stepper interrupt execution time since power up, in CPU cycles. Sets the step rate ceiling.
+  static volatile uint32_t st_isr_cycles_peak;
+
+  // Segment prep load since the last st_get_prep_load(), in CPU cycles. Only prep calls that output
+  // segments are counted busy, so the main loop polling a full buffer does not count.
+  #define ST_PREP_MAX_GAP F_CPU // A longer gap between prep calls is not running motion.
+  static uint64_t st_prep_busy_cycles; // Spent prepping segments
+  static uint64_t st_prep_run_cycles;  // Elapsed between prep calls, while running motion
+  static uint32_t st_prep_segment_count; // Segments output
+  static uint32_t st_prep_last_call;
+  #ifdef DEBUG
+    // Worst case stepper interrupt timing since the last debug report, in CPU cycles.
+    static volatile uint32_t st_isr_latency_max; // From the timer update to the step pins written
+    static volatile uint32_t st_isr_cycles_max;  // Full interrupt execution time
+  #endif
+
+  static inline void st_record_isr_cycles(uint32_t cycles)
+  {
+    if (cycles > st_isr_cycles_peak) { st_isr_cycles_peak = cycles; }
+    #ifdef DEBUG
+      if (cycles > st_isr_cycles_max) { st_isr_cycles_max = cycles; }
+    #endif
+  }
+#endif
+
+#ifdef STEP_DMA_BSRR
+  // BSRR words clocked out to the step port, in two halves. See the DMA Step Generator below.
+  static uint32_t st_dma_buffer[2*STEP_DMA_HALF_BUFFER];
+
+  // DMA step generator data. Times are in DMA periods from the start of the half being rendered.
+  typedef struct {
+    uint8_t running;            // DMA drives the pins. The stepper interrupt is off.
+    uint8_t idle_halves;        // Halves rendered in a row without steps
+    uint16_t pulse_periods;     // Step pulse time
+    uint16_t free_period;       // First period the next step or direction change may start in
+    uint16_t reset_period;      // Period that ends the step pulse carried over to the next half
+    PORTPINDEF reset_bits;      // Step bits of the carried over pulse, or zero
+    PORTPINDEF dir_bits;        // Direction pins as last set, with the invert mask
+    uint32_t cycles_per_period; // CPU cycles per DMA period
+    uint32_t tick_time;         // Next Bresenham tick, in 16.16 fixed point
+    uint32_t tick_periods;      // Bresenham tick period of the loaded segment, in 16.16 fixed point
+  } st_dma_t;
+  static st_dma_t st_dma;
+
+  static void st_dma_start();
+  static void st_dma_stop();
+#endif
+
+#ifdef STEP_PER_AXIS_TIMING
+  // Per-axis step channel. See the Per-Axis Step Timing below. Times are CPU cycles on a 32 bit
+  // timeline, whose low 16 bits are the TIM2 counter.
+  typedef struct {
+    uint8_t state;          // ST_AXIS_IDLE, ST_AXIS_STEP or ST_AXIS_PULSE
+    uint32_t steps_left;    // Steps left to put out in the open window
+    uint32_t event;         // Next pin edge
+    uint32_t compare;       // Programmed compare. Short of the event when it is over 0x8000 cycles away.
+    uint32_t next_step;     // Exact time of the next step, before any delay for the pulse or direction
+    uint32_t spacing;       // Step spacing in whole cycles
+    uint32_t spacing_rem;   // and its remainder, in 1/divisor cycles
+    uint32_t error;         // Accumulated remainder, in 1/divisor cycles
+    uint32_t divisor;       // Bresenham axis increment of the segment
+  } st_axis_t;
+
+  typedef struct {
+    uint8_t running;        // The TIM2 compare channels drive the step pins. The stepper interrupt is off.
+    uint8_t window_open;    // The executing segment has its window open.
+    uint8_t draining;       // Segment buffer empty. Waiting out the last step pulses.
+    PORTPINDEF dir_bits;    // Direction pins as last set, with the invert mask
+    uint32_t pulse_cycles;  // Step pulse time
+    uint32_t window_end;    // End of the window, on TIM2 channel 4
+    uint32_t window_compare;
+    st_axis_t axis[N_AXIS];
+  } st_timing_t;
+  static st_timing_t st_timing;
+
+  static void st_axis_start();
+  static void st_axis_stop();
+  static void st_axis_step_pin_mode(GPIOMode_TypeDef mode);
+  static void st_axis_isr();
+#endif
+
+#ifdef STM32F103C8
+  // Loads the tick period, prescaler and step pulse compare of the executing segment into TIM2. The
+  // period applies at once. A prescaler change only loads at an update event, so one is forced,
+  // which restarts the counter, and the update flag it sets is cleared so it is not taken as a tick.
+  static inline void st_set_segment_timer()
+  {
+    uint8_t prescaler = st.exec_segment->prescaler;
+    TIM2->ARR = st.exec_segment->cycles_per_tick - 1;
+    TIM2->CCR4 = (st.step_pulse_time + (1 << prescaler) - 1) >> prescaler;
+    if (TIM2->PSC != (1 << prescaler) - 1) {
+      TIM2->PSC = (1 << prescaler) - 1;
+      TIM2->EGR = TIM_EGR_UG;
+      TIM2->SR = (uint16_t)~TIM_SR_UIF;
+    }
+  }
+#endif
+
 // Pointers for the step segment being prepped from the planner buffer. Accessed only by the
 // main program. Pointers may be planning segments or planner blocks ahead of what being executed.
 static plan_block_t *pl_block;     // Pointer to the planner block being prepped
@@ -189,6 +346,20 @@ typedef struct {
   float accelerate_until; // Acceleration ramp end measured from end of block (mm)
   float decelerate_after; // Deceleration ramp start measured from end of block (mm)
 
+  #ifdef S_CURVE_ACCELERATION
+    plan_block_t *s_last_block; // Planner block the S-curve ramp ends in. NULL, if no ramp in progress.
+    uint8_t s_decelerate;   // True, if the ramp decelerates.
+    float s_start_speed;    // Speed at the start of the ramp (mm/min)
+    float s_end_speed;      // Speed at the end of the ramp (mm/min)
+    float s_delta_speed;    // Speed change over the ramp. Always positive. (mm/min)
+    float s_distance;       // Length of the ramp (mm)
+    float s_duration;       // Time of the ramp (min)
+    float s_jerk_time;      // Time the acceleration takes to rise to its peak, and to fall from it (min)
+    float s_peak_accel;     // Peak acceleration (mm/min^2)
+    float s_time;           // Time from the start of the ramp to the end of the segment buffer (min)
+    float s_traveled;       // Distance from the start of the ramp to the end of the segment buffer (mm)
+  #endif
+
   #ifdef VARIABLE_SPINDLE
     float inv_rate;    // Used by PWM laser mode to speed up segment calculations.
     uint8_t current_spindle_pwm;
@@ -196,6 +367,39 @@ typedef struct {
 } st_prep_t;
 static st_prep_t prep;
 
+#ifdef INPUT_SHAPING
+  // Prepped segment queued in the input shaper. Complete, but for its step timing.
+  typedef struct {
+    segment_t segment;
+    float dt;           // Commanded segment time (min)
+    float mm;           // Segment distance (mm)
+    float speed;        // Commanded speed over the segment (mm/min)
+    float steps;        // Step distance, including the partial steps at either end
+    float partial_step; // Partial step at the end of the segment, executed with the next one
+  } shaper_segment_t;
+
+  // Input shaper data. See the Input Shaper below.
+  typedef struct {
+    shaper_segment_t segment[SHAPER_BUFFER_SIZE];
+    uint8_t tail;     // Oldest queued segment, kept until no impulse cursor is in it
+    uint8_t output;   // Next segment to output
+    uint8_t head;     // Next segment to queue
+
+    uint8_t n_impulses;
+    float amplitude[SHAPER_MAX_IMPULSES];
+    float delay[SHAPER_MAX_IMPULSES];       // (min)
+    uint8_t cursor[SHAPER_MAX_IMPULSES];    // Queued segment at the delayed time of each impulse. Head, if past them.
+    float cursor_time[SHAPER_MAX_IMPULSES]; // Time into that segment. Negative, before it starts. (min)
+
+    uint8_t started;         // The output segment distance is added to the remaining distance.
+    float remaining;         // Shaped distance left to the end of the output segment (mm)
+    float duration;          // Shaped time of the output segment so far (min)
+    uint8_t st_block_index;  // Stepper block of the last output segment
+    float dt_remainder;      // Execute time of the partial step at the end of the last output segment
+  } shaper_t;
+  static shaper_t shaper;
+#endif
+
 
 /*    BLOCK VELOCITY PROFILE DEFINITION
           __________________________
@@ -233,6 +437,25 @@ static st_prep_t prep;
   The step segment buffer computes the executing block velocity profile and tracks the critical
   parameters for the stepper algorithm to accurately trace the profile. These critical parameters
   are shown and defined in the above illustration.
+
+  With S_CURVE_ACCELERATION, the segments trace every acceleration and deceleration ramp of these
+  profiles as a jerk-limited S-curve. Over a ramp of time T from speed v0 to v1, the acceleration
+  rises at the jerk limit J for a time tau, holds its peak A, and falls back to zero over the last
+  tau. The curve is symmetric, so it covers the same distance (v0+v1)*T/2 as the constant
+  acceleration ramp. The ramp ends at the same point, at the same time and speed, which keeps the
+  plan, the feed hold stopping points and the step counts exact. Solving A*(T-tau) = v1-v0 for a
+  jerk of A/tau = J gives
+
+    tau = (T - sqrt(T^2 - 4*(v1-v0)/J))/2,   A = (v1-v0)/(T-tau)
+
+  which peaks at twice the mean acceleration when the ramp is too short for J, tau = T/2.
+    A ramp continues through the following planner blocks, for as long as their profiles keep
+  ramping the same way and the junction and block speed limits allow the ramp speed. Otherwise,
+  the acceleration would fall to zero at every junction of the short blocks of arcs and SCARA
+  lines. The segments are timed on the ramp curve, and a block ends where the ramp passes its end,
+  found by bisection. Planner blocks further ahead may be replanned without notice, so each block,
+  as it is loaded or replanned, is checked against the ramp. If the plan changed, a new ramp starts
+  from the current speed at zero acceleration.
 */
 
 
@@ -268,23 +491,35 @@ void st_wake_up()
 #endif
   #endif
 
+  #ifdef STEP_DMA_BSRR
+    // Homing and probing stop on the step a switch trips, so they stay on the stepper interrupt.
+    if (st_dma.running) { return; }
+    if ((sys.state != STATE_HOMING) && (sys_probe_state != PROBE_ACTIVE)) {
+      st_dma_start();
+      return;
+    }
+  #endif
+  #ifdef STEP_PER_AXIS_TIMING
+    // Homing and probing stop on the step a switch trips, so they stay on the stepper interrupt.
+    if (st_timing.running) { return; }
+    if ((sys.state != STATE_HOMING) && (sys_probe_state != PROBE_ACTIVE)) {
+      st_axis_start();
+      return;
+    }
+    st_axis_step_pin_mode(GPIO_Mode_Out_PP);
+  #endif
+
   // Enable Stepper Driver Interrupt
 #ifdef AVRTARGET
   TIMSK1 |= (1<<OCIE1A);
 #endif
 
 #if defined (STM32F103C8)
-  TIM3->ARR = st.step_pulse_time - 1;
-  TIM3->EGR = TIM_PSCReloadMode_Immediate;
-  TIM_ClearITPendingBit(TIM3, TIM_IT_Update);
-
-  TIM2->ARR = st.exec_segment->cycles_per_tick - 1;
-  /* Set the Autoreload value */
-#ifndef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING        
-  TIM2->PSC = st.exec_segment->prescaler;
-#endif
+  // The step pulse ends on the TIM2 channel 4 compare, counted from the update event that began it.
+  TIM2->CCR4 = st.step_pulse_time;
+  if (st.exec_segment != NULL) { st_set_segment_timer(); }
   TIM2->EGR = TIM_PSCReloadMode_Immediate;
-  NVIC_EnableIRQ(TIM2_IRQn);
+  TIM2->DIER |= TIM_DIER_UIE;
 #endif
 }
 
@@ -299,7 +534,13 @@ void st_go_idle()
 #endif
 
 #ifdef STM32F103C8
-  NVIC_DisableIRQ(TIM2_IRQn);
+  TIM2->DIER &= ~TIM_DIER_UIE; // Leaves the compare interrupt to end a step pulse in progress.
+#endif
+#ifdef STEP_DMA_BSRR
+  if (st_dma.running) { st_dma_stop(); }
+#endif
+#ifdef STEP_PER_AXIS_TIMING
+  if (st_timing.running) { st_axis_stop(); }
 #endif
 
   busy = false;
@@ -324,6 +565,565 @@ void st_go_idle()
 }
 
 
+// Adds the steps taken in the executing segment to sys_position and restarts the count. All axes
+// of a segment move in the direction of its block.
+static void st_fold_segment_steps()
+{
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (st.exec_block->direction_bits & direction_pin_mask[idx]) { sys_position[idx] -= st.segment_steps[idx]; }
+    else { sys_position[idx] += st.segment_steps[idx]; }
+    st.segment_steps[idx] = 0;
+  }
+}
+
+
+// Discards the executing segment, once all its steps are out, and advances segment indexing.
+static void st_discard_segment()
+{
+  st_fold_segment_steps();
+  st.exec_segment = NULL;
+  uint8_t segment_tail_next = segment_buffer_tail + 1;
+  if (segment_tail_next == SEGMENT_BUFFER_SIZE) { segment_tail_next = 0; }
+  segment_buffer_tail = segment_tail_next;
+}
+
+
+// Pops the next step segment from the segment buffer, and initializes the Bresenham counters and
+// direction bits of its block. Returns false if the buffer is empty. Shared by the step generators.
+static uint8_t st_load_segment()
+{
+  if (segment_buffer_head == segment_buffer_tail) { return(false); }
+
+  // Initialize new step segment and load number of steps to execute
+  st.exec_segment = &segment_buffer[segment_buffer_tail];
+  st.step_count = st.exec_segment->n_step; // NOTE: Can sometimes be zero when moving slow.
+  // If the new segment starts a new planner block, initialize stepper variables and counters.
+  // NOTE: When the segment data index changes, this indicates a new planner block.
+  if ( st.exec_block_index != st.exec_segment->st_block_index ) {
+    st.exec_block_index = st.exec_segment->st_block_index;
+    st.exec_block = &st_block_buffer[st.exec_block_index];
+
+    // Initialize Bresenham line and distance counters
+    st.counter_x = st.counter_y = st.counter_z = (st.exec_block->step_event_count >> 1);
+  }
+  st.dir_outbits = st.exec_block->direction_bits ^ dir_port_invert_mask;
+
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    // With AMASS enabled, adjust Bresenham axis increment counters according to AMASS level.
+    st.steps[X_AXIS] = st.exec_block->steps[X_AXIS] >> st.exec_segment->amass_level;
+    st.steps[Y_AXIS] = st.exec_block->steps[Y_AXIS] >> st.exec_segment->amass_level;
+    st.steps[Z_AXIS] = st.exec_block->steps[Z_AXIS] >> st.exec_segment->amass_level;
+  #endif
+
+  #ifdef VARIABLE_SPINDLE
+    // Set real-time spindle output as segment is loaded, just prior to the first step.
+    spindle_set_speed(st.exec_segment->spindle_pwm);
+  #endif
+  return(true);
+}
+
+
+// Executes one Bresenham tick of the loaded segment and returns the step bits to pulse, without the
+// step port invert mask. Discards the segment when its last tick is done.
+static PORTPINDEF st_bresenham_tick()
+{
+  PORTPINDEF step_outbits = 0;
+
+  // Execute step displacement profile by Bresenham line algorithm
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    st.counter_x += st.steps[X_AXIS];
+  #else
+    st.counter_x += st.exec_block->steps[X_AXIS];
+  #endif
+  if (st.counter_x > st.exec_block->step_event_count) {
+    step_outbits |= (1<<X_STEP_BIT);
+    st.counter_x -= st.exec_block->step_event_count;
+    st.segment_steps[X_AXIS]++;
+  }
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    st.counter_y += st.steps[Y_AXIS];
+  #else
+    st.counter_y += st.exec_block->steps[Y_AXIS];
+  #endif
+  if (st.counter_y > st.exec_block->step_event_count) {
+    step_outbits |= (1<<Y_STEP_BIT);
+    st.counter_y -= st.exec_block->step_event_count;
+    st.segment_steps[Y_AXIS]++;
+  }
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    st.counter_z += st.steps[Z_AXIS];
+  #else
+    st.counter_z += st.exec_block->steps[Z_AXIS];
+  #endif
+  if (st.counter_z > st.exec_block->step_event_count) {
+    step_outbits |= (1<<Z_STEP_BIT);
+    st.counter_z -= st.exec_block->step_event_count;
+    st.segment_steps[Z_AXIS]++;
+  }
+
+  // During a homing cycle, lock out and prevent desired axes from moving.
+  if (sys.state == STATE_HOMING) { step_outbits &= sys.homing_axis_lock; }
+
+  st.step_count--; // Decrement step events count
+  if (st.step_count == 0) { st_discard_segment(); } // Segment is complete.
+
+  return(step_outbits);
+}
+
+
+#ifdef STEP_DMA_BSRR
+/* The DMA Step Generator: With STEP_DMA_BSRR, the step and direction pins are driven by DMA rather
+   than the stepper interrupt. TIM4 update events clock a ring buffer of GPIO BSRR words out to the
+   step port on DMA1 channel 7, one word per STEP_DMA_FREQUENCY period. A BSRR word sets and resets
+   pins in a single write, so there is no read-modify-write of the port. The DMA half and full
+   transfer interrupts render the half of the buffer that just went out, so the CPU runs once per
+   half buffer instead of twice per step.
+     Rendering runs the same Bresenham tick as the stepper interrupt. Ticks are timed in 16.16 fixed
+   point DMA periods, so a segment keeps its exact step rate on average and only the pulse edges are
+   quantized to the DMA period. A step pulse lasts the step pulse setting rounded up to whole periods,
+   and the next pulse or direction change waits a period after it ends. Ticks that would come sooner
+   are delayed, which sets the maximum step rate.
+   NOTE: sys_position is counted as the steps are rendered, so it leads the motors by up to two
+   buffer halves. Homing and probing latch the position of a switch and run on the stepper
+   interrupt instead.
+*/
+
+// Sets the tick period of the loaded segment in DMA periods. Ticks longer than 2^15 DMA periods,
+// 164msec at 200kHz, are cut short, where the steps are slower than 1Hz with AMASS.
+static void st_dma_set_tick_periods()
+{
+  uint64_t periods = ((uint64_t)st.exec_segment->cycles_per_tick << (16 + st.exec_segment->prescaler))
+                     / st_dma.cycles_per_period;
+  if (periods > (1UL << 31)) { periods = (1UL << 31); }
+  st_dma.tick_periods = periods;
+}
+
+
+// Renders the next half buffer of BSRR words from the segment buffer. Returns false after two
+// halves without steps, once everything rendered has gone out.
+static uint8_t st_dma_render(uint32_t *half)
+{
+  memset(half, 0, STEP_DMA_HALF_BUFFER*sizeof(uint32_t));
+  uint8_t active = false;
+  if (st_dma.reset_bits) { // Ends the step pulse carried over from the last half.
+    half[st_dma.reset_period] = st_bsrr(st_dma.reset_bits, step_port_invert_mask);
+    st_dma.reset_bits = 0;
+    active = true;
+  }
+
+  while (1) {
+    if ((st_dma.tick_time >> 16) < st_dma.free_period) { st_dma.tick_time = (uint32_t)st_dma.free_period << 16; }
+    uint16_t period = st_dma.tick_time >> 16;
+    if (period >= STEP_DMA_HALF_BUFFER) { break; }
+
+    if (st.exec_segment == NULL) {
+      if (!st_load_segment()) {
+        // Segment buffer empty. Steps of the next segment start with the next half.
+        st_dma.tick_time = (uint32_t)STEP_DMA_HALF_BUFFER << 16;
+        break;
+      }
+      st_dma_set_tick_periods();
+      if ((st.dir_outbits ^ st_dma.dir_bits) & DIRECTION_MASK) {
+        // Set the direction pins a period before the next step.
+        st_dma.dir_bits = st.dir_outbits;
+        half[period] |= st_bsrr(DIRECTION_MASK, st_dma.dir_bits);
+        st_dma.free_period = period+1;
+        continue;
+      }
+    }
+
+    active = true;
+    PORTPINDEF step_bits = st_bresenham_tick();
+    if (step_bits) {
+      half[period] |= st_bsrr(step_bits, ~step_port_invert_mask);
+      uint16_t reset_period = period + st_dma.pulse_periods;
+      if (reset_period < STEP_DMA_HALF_BUFFER) {
+        half[reset_period] |= st_bsrr(step_bits, step_port_invert_mask);
+      } else {
+        st_dma.reset_bits = step_bits;
+        st_dma.reset_period = reset_period - STEP_DMA_HALF_BUFFER;
+      }
+      st_dma.free_period = reset_period+1;
+    }
+    st_dma.tick_time += st_dma.tick_periods;
+  }
+
+  // Move the timing to the start of the next half.
+  st_dma.tick_time -= (uint32_t)STEP_DMA_HALF_BUFFER << 16;
+  if (st_dma.free_period > STEP_DMA_HALF_BUFFER) { st_dma.free_period -= STEP_DMA_HALF_BUFFER; }
+  else { st_dma.free_period = 0; }
+
+  if (active) { st_dma.idle_halves = 0; }
+  else { st_dma.idle_halves++; }
+  return(st_dma.idle_halves < 2);
+}
+
+
+// Renders both halves of the buffer and starts clocking them out.
+static void st_dma_start()
+{
+  st_dma.cycles_per_period = F_CPU/STEP_DMA_FREQUENCY;
+  st_dma.pulse_periods = ((uint32_t)settings.pulse_microseconds*STEP_DMA_FREQUENCY + 999999)/1000000;
+  if (st_dma.pulse_periods == 0) { st_dma.pulse_periods = 1; }
+  st_dma.tick_time = 0;
+  st_dma.free_period = 0;
+  st_dma.reset_bits = 0;
+  st_dma.idle_halves = 0;
+  st_dma.dir_bits = GPIO_ReadOutputData(DIRECTION_PORT) & DIRECTION_MASK;
+  if (st.exec_segment != NULL) { // Resumes a segment left by the stepper interrupt.
+    st_dma_set_tick_periods();
+  }
+  st_dma_render(st_dma_buffer);
+  st_dma_render(&st_dma_buffer[STEP_DMA_HALF_BUFFER]);
+
+  DMA1_Channel7->CCR = 0;
+  DMA1->IFCR = DMA1_IT_GL7;
+  DMA1_Channel7->CPAR = (uint32_t)&STEP_PORT->BSRR;
+  DMA1_Channel7->CMAR = (uint32_t)st_dma_buffer;
+  DMA1_Channel7->CNDTR = 2*STEP_DMA_HALF_BUFFER;
+  DMA1_Channel7->CCR = DMA_DIR_PeripheralDST | DMA_Mode_Circular | DMA_MemoryInc_Enable |
+                       DMA_PeripheralDataSize_Word | DMA_MemoryDataSize_Word | DMA_Priority_VeryHigh |
+                       DMA_IT_HT | DMA_IT_TC | DMA_CCR1_EN;
+  TIM4->ARR = st_dma.cycles_per_period - 1;
+  TIM4->CNT = 0;
+  TIM4->DIER = TIM_DMA_Update;
+  st_dma.running = true;
+  TIM4->CR1 |= TIM_CR1_CEN;
+}
+
+
+// Stops the DMA, leaving the step pins idle.
+static void st_dma_stop()
+{
+  TIM4->CR1 &= ~TIM_CR1_CEN;
+  TIM4->DIER = 0;
+  DMA1_Channel7->CCR &= ~DMA_CCR1_EN;
+  DMA1->IFCR = DMA1_IT_GL7;
+  st_dma.running = false;
+  STEP_PORT->BSRR = st_bsrr(STEP_MASK, step_port_invert_mask);
+}
+
+
+// DMA half and full transfer interrupt. Renders the half that was just clocked out.
+void DMA1_Channel7_IRQHandler(void)
+{
+  uint32_t flags = DMA1->ISR;
+  uint8_t running = true;
+  if (flags & DMA1_IT_HT7) {
+    DMA1->IFCR = DMA1_IT_HT7;
+    running = st_dma_render(st_dma_buffer);
+  }
+  if ((flags & DMA1_IT_TC7) && running) {
+    DMA1->IFCR = DMA1_IT_TC7;
+    running = st_dma_render(&st_dma_buffer[STEP_DMA_HALF_BUFFER]);
+  }
+  if (!running) {
+    // Segment buffer empty and all steps out. Shutdown.
+    st_go_idle();
+    // Ensure pwm is set properly upon completion of rate-controlled motion.
+    #ifdef VARIABLE_SPINDLE
+    if (st.exec_block->is_pwm_rate_adjusted) { spindle_set_speed(SPINDLE_PWM_OFF_VALUE); }
+    #endif
+    system_set_exec_state_flag(EXEC_CYCLE_STOP); // Flag main program for cycle end
+  }
+}
+#endif
+
+
+#ifdef STEP_PER_AXIS_TIMING
+/* Per-Axis Step Timing: With STEP_PER_AXIS_TIMING, each axis puts out its steps on its own TIM2
+   output compare channel, rather than on the Bresenham ticks of the stepper interrupt. The step pins
+   PA0-PA2 are the channel 1-3 outputs, so the compare match sets and resets the pin in hardware and
+   the edges are exact to the CPU cycle, whatever the interrupt latency. TIM2 counts CPU cycles and
+   wraps every 65536. Edges further than half of that away step through intermediate compares.
+     A segment runs in a window of its n_step ticks, timed on channel 4. When the window opens, each
+   axis takes the same number of steps the Bresenham counters would over those ticks, so the step
+   counts and the Bresenham counters stay exact. Each step goes out where its counter crosses the
+   step event count, without rounding to a tick. The non-dominant axes then step at even intervals
+   of their own rate, rather than at the aliased ticks of the dominant axis, and without needing
+   AMASS to do it. The spacing remainders carry from step to step, so there is no drift.
+     Every step costs a rising and a falling edge interrupt. A step waits for the pulse before it to
+   end, and the edges are not retimed to the latency, which sets the maximum step rate.
+   NOTE: The direction pins are set as a window opens. A window that reverses an axis waits until
+   that axis has put out every step and pulse it still has from the window before, so no step goes
+   out in the wrong direction. The first step of a reversing axis then waits a step pulse time after
+   the direction pins are set. Homing and probing run on the stepper interrupt,
+   since the switch is checked on every tick.
+*/
+
+#define ST_AXIS_LEAD 64 // CPU cycles. Least step low time, and the lead of a compare that is late.
+#define ST_AXIS_WINDOW N_AXIS // TIM2 channel index of the segment window. Axis idx is on channel idx+1.
+
+// TIM2 output compare modes, OCxM
+#define ST_OC_FROZEN 0
+#define ST_OC_ACTIVE 1          // Set the pin on match
+#define ST_OC_INACTIVE 2        // Reset the pin on match
+#define ST_OC_FORCE_INACTIVE 4
+
+// Step channel states
+#define ST_AXIS_IDLE 0
+#define ST_AXIS_STEP 1  // Rising edge pending
+#define ST_AXIS_PULSE 2 // Falling edge pending
+
+
+static void st_axis_set_mode(uint8_t ch, uint16_t mode)
+{
+  volatile uint16_t *ccmr = (ch < 2) ? &TIM2->CCMR1 : &TIM2->CCMR2;
+  uint8_t shift = (ch & 1) ? 12 : 4;
+  *ccmr = (*ccmr & ~(0x7 << shift)) | (mode << shift);
+}
+
+
+// Programs the compare of channel 'ch' for an edge at 'time', counted from its last compare at
+// 'from'. Returns the compare time, which is an intermediate one for edges over 0x8000 cycles away.
+static uint32_t st_axis_program(uint8_t ch, uint32_t from, uint32_t time, uint16_t mode)
+{
+  uint32_t compare = time;
+  if ((int32_t)(time - from) > 0x8000) {
+    compare = from + 0x8000;
+    mode = ST_OC_FROZEN;
+  }
+  volatile uint16_t *ccr = &TIM2->CCR1 + 2*ch; // CCRx are 16 bits apart by 16 bits of padding.
+  *ccr = compare;
+  st_axis_set_mode(ch, mode);
+  // A compare the counter has passed only matches after it wraps. Put the edge out a little late.
+  if ((int16_t)((uint16_t)compare - TIM2->CNT) <= 0) { *ccr = TIM2->CNT + ST_AXIS_LEAD; }
+  return(compare);
+}
+
+
+// Opens the window of the executing segment at 'start'. Each axis is given the steps its Bresenham
+// counter takes over the remaining ticks, and the counter is advanced past them. A counter ends
+// every tick in 1 to step_event_count, so that is the ceiling of the counter total over the step
+// event count, less one. Returns false, without opening it, while an axis the window reverses still
+// has steps or a pulse going out.
+static uint8_t st_axis_open_window(uint32_t start)
+{
+  PORTPINDEF dir_change = (st.dir_outbits ^ st_timing.dir_bits) & DIRECTION_MASK;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    // Steps left over imply a pending edge, so the axis is not idle.
+    if ((dir_change & direction_pin_mask[idx]) && (st_timing.axis[idx].state != ST_AXIS_IDLE)) { return(false); }
+  }
+
+  uint32_t tick_cycles = (uint32_t)st.exec_segment->cycles_per_tick << st.exec_segment->prescaler;
+  uint64_t window = (uint64_t)tick_cycles*st.step_count;
+  if (window > 0x7fffffff) { window = 0x7fffffff; }
+
+  st_timing.dir_bits = st.dir_outbits;
+  DIRECTION_PORT->BSRR = st_bsrr(DIRECTION_MASK, st.dir_outbits);
+  uint32_t dir_time = start + (uint16_t)(TIM2->CNT - (uint16_t)start); // Interrupt runs after start.
+
+  uint32_t event_count = st.exec_block->step_event_count;
+  uint32_t *counter[N_AXIS] = { &st.counter_x, &st.counter_y, &st.counter_z };
+  for (idx=0; idx<N_AXIS; idx++) {
+    #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+      uint32_t steps = st.steps[idx];
+    #else
+      uint32_t steps = st.exec_block->steps[idx];
+    #endif
+    if ((steps == 0) || (st.step_count == 0)) { continue; }
+    uint32_t count = *counter[idx];
+    uint64_t total = count + (uint64_t)steps*st.step_count;
+    uint32_t n_step = (total - 1)/event_count;
+    *counter[idx] = total - (uint64_t)n_step*event_count;
+    if (n_step == 0) { continue; }
+
+    // The counter crosses the step event count (event_count-count)/steps ticks in, then every
+    // event_count/steps ticks.
+    st_axis_t *axis = &st_timing.axis[idx];
+    uint64_t time = (uint64_t)(event_count - count)*tick_cycles;
+    axis->next_step = start + time/steps;
+    axis->error = time % steps;
+    time = (uint64_t)event_count*tick_cycles;
+    axis->spacing = min(time/steps, 0x7fffffff);
+    axis->spacing_rem = time % steps;
+    axis->divisor = steps;
+    axis->steps_left += n_step;
+
+    // An axis still in its last pulse picks up the next step when the pulse ends. It keeps its
+    // direction, so reversing axes are always idle here.
+    if (axis->state == ST_AXIS_IDLE) {
+      axis->state = ST_AXIS_STEP;
+      axis->event = axis->next_step;
+      if ((dir_change & direction_pin_mask[idx]) &&
+          ((int32_t)(axis->event - dir_time) < (int32_t)st_timing.pulse_cycles)) {
+        axis->event = dir_time + st_timing.pulse_cycles; // Direction setup time
+      }
+      axis->compare = st_axis_program(idx, start, axis->event, ST_OC_ACTIVE);
+      TIM2->DIER |= (TIM_DIER_CC1IE << idx);
+    }
+  }
+
+  st_timing.window_end = start + window;
+  st_timing.window_compare = st_axis_program(ST_AXIS_WINDOW, start, st_timing.window_end, ST_OC_FROZEN);
+  st_timing.window_open = true;
+  return(true);
+}
+
+
+// Opens the window of the executing segment at the end of the last one. If a reversing axis is
+// still busy, the window compare retries a step pulse time later.
+static void st_axis_next_window()
+{
+  if (st_axis_open_window(st_timing.window_end)) { return; }
+  st_timing.window_end += st_timing.pulse_cycles + ST_AXIS_LEAD;
+  st_timing.window_compare = st_axis_program(ST_AXIS_WINDOW, st_timing.window_compare,
+                                             st_timing.window_end, ST_OC_FROZEN);
+}
+
+
+// Step channel compare of axis 'idx'.
+static void st_axis_event(uint8_t idx)
+{
+  st_axis_t *axis = &st_timing.axis[idx];
+  if (axis->compare != axis->event) { // Intermediate compare
+    axis->compare = st_axis_program(idx, axis->compare, axis->event,
+                                    (axis->state == ST_AXIS_STEP) ? ST_OC_ACTIVE : ST_OC_INACTIVE);
+    return;
+  }
+
+  if (axis->state == ST_AXIS_STEP) {
+    // The pin went active. Count the step and end the pulse.
+    st.segment_steps[idx]++;
+    axis->steps_left--;
+    axis->next_step += axis->spacing;
+    axis->error += axis->spacing_rem;
+    if (axis->error >= axis->divisor) {
+      axis->next_step++;
+      axis->error -= axis->divisor;
+    }
+    axis->state = ST_AXIS_PULSE;
+    axis->event += st_timing.pulse_cycles;
+    axis->compare = st_axis_program(idx, axis->compare, axis->event, ST_OC_INACTIVE);
+  } else {
+    // The pulse is over. Start the next step, no sooner than the least step low time.
+    if (axis->steps_left == 0) {
+      axis->state = ST_AXIS_IDLE;
+      TIM2->DIER &= ~(TIM_DIER_CC1IE << idx);
+      return;
+    }
+    axis->state = ST_AXIS_STEP;
+    axis->event = axis->next_step;
+    if ((int32_t)(axis->event - axis->compare) < ST_AXIS_LEAD) { axis->event = axis->compare + ST_AXIS_LEAD; }
+    axis->compare = st_axis_program(idx, axis->compare, axis->event, ST_OC_ACTIVE);
+  }
+}
+
+
+// Segment window compare. Retires the segment of the window that ended and opens the next one.
+static void st_axis_window_event()
+{
+  if (st_timing.window_compare != st_timing.window_end) { // Intermediate compare
+    st_timing.window_compare = st_axis_program(ST_AXIS_WINDOW, st_timing.window_compare,
+                                               st_timing.window_end, ST_OC_FROZEN);
+    return;
+  }
+
+  if (st_timing.draining) {
+    st_timing.draining = false;
+    if (st_load_segment()) { // Refilled in the meantime.
+      st_axis_next_window();
+      return;
+    }
+    // Segment buffer empty and the last pulses are over. Shutdown.
+    st_go_idle();
+    // Ensure pwm is set properly upon completion of rate-controlled motion.
+    #ifdef VARIABLE_SPINDLE
+    if (st.exec_block->is_pwm_rate_adjusted) { spindle_set_speed(SPINDLE_PWM_OFF_VALUE); }
+    #endif
+    system_set_exec_state_flag(EXEC_CYCLE_STOP); // Flag main program for cycle end
+    return;
+  }
+
+  if (st_timing.window_open) {
+    st_discard_segment();
+    st_timing.window_open = false;
+  }
+  if ((st.exec_segment == NULL) && !st_load_segment()) {
+    // Leave the last step pulses time to end, before the pins are forced idle.
+    st_timing.draining = true;
+    st_timing.window_end += st_timing.pulse_cycles + ST_AXIS_LEAD;
+    st_timing.window_compare = st_axis_program(ST_AXIS_WINDOW, st_timing.window_compare,
+                                               st_timing.window_end, ST_OC_FROZEN);
+    return;
+  }
+  // Retried here with the segment loaded and its window still closed.
+  st_axis_next_window();
+}
+
+
+// TIM2 interrupt while the channels drive the step pins. The step edges are handled before the
+// window, so steps due at the end of a window are counted in its segment.
+static void st_axis_isr()
+{
+  uint16_t status = TIM2->SR & TIM2->DIER;
+  TIM2->SR = (uint16_t)~status; // rc_w0. Writing ones leaves other flags.
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (status & (TIM_SR_CC1IF << idx)) { st_axis_event(idx); }
+  }
+  if (status & TIM_SR_CC4IF) { st_axis_window_event(); }
+}
+
+
+// Switches the step pins between the GPIO outputs of the stepper interrupt and the TIM2 channels.
+static void st_axis_step_pin_mode(GPIOMode_TypeDef mode)
+{
+  GPIO_InitTypeDef GPIO_InitStructure;
+  GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+  GPIO_InitStructure.GPIO_Mode = mode;
+  GPIO_InitStructure.GPIO_Pin = STEP_MASK;
+  GPIO_Init(STEP_PORT, &GPIO_InitStructure);
+}
+
+
+// Runs TIM2 free at the CPU clock, hands it the step pins and opens the first window just ahead.
+static void st_axis_start()
+{
+  TIM2->DIER = 0;
+  TIM2->PSC = 0;
+  TIM2->ARR = 0xffff;
+  TIM2->EGR = TIM_EGR_UG;
+  uint16_t ccer = 0;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    st_axis_set_mode(idx, ST_OC_FORCE_INACTIVE);
+    ccer |= TIM_CCER_CC1E << (4*idx);
+    if (step_port_invert_mask & step_pin_mask[idx]) { ccer |= TIM_CCER_CC1P << (4*idx); }
+  }
+  TIM2->CCER = ccer;
+  st_axis_step_pin_mode(GPIO_Mode_AF_PP);
+
+  st_timing.pulse_cycles = st.step_pulse_time;
+  st_timing.dir_bits = GPIO_ReadOutputData(DIRECTION_PORT) & DIRECTION_MASK;
+  st_timing.window_open = false; // Opens the segment left by the stepper interrupt, if any.
+  st_timing.draining = false;
+  TIM2->SR = 0;
+  uint32_t now = TIM2->CNT;
+  st_timing.window_end = now + ST_AXIS_LEAD;
+  st_timing.window_compare = st_axis_program(ST_AXIS_WINDOW, now, st_timing.window_end, ST_OC_FROZEN);
+  st_timing.running = true;
+  TIM2->DIER = TIM_DIER_CC4IE;
+}
+
+
+// Stops the channels, forcing the step pins idle.
+static void st_axis_stop()
+{
+  TIM2->DIER = 0;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    st_axis_set_mode(idx, ST_OC_FORCE_INACTIVE);
+    st_timing.axis[idx].state = ST_AXIS_IDLE;
+    st_timing.axis[idx].steps_left = 0;
+  }
+  st_timing.running = false;
+}
+#endif
+
+
 /* "The Stepper Driver Interrupt" - This timer interrupt is the workhorse of Grbl. Grbl employs
    the venerable Bresenham line algorithm to manage and exactly synchronize multi-axis moves.
    Unlike the popular DDA algorithm, the Bresenham algorithm is not susceptible to numerical
@@ -369,9 +1169,9 @@ void st_go_idle()
    ISR is 5usec typical and 25usec maximum, well below requirement.
    NOTE: This ISR expects at least one step to be executed per segment.
 */
-// TODO: Replace direct updating of the int32 position counters in the ISR somehow. Perhaps use smaller
-// int8 variables and update position counters only when a segment completes. This can get complicated
-// with probing and homing cycles that require true real-time positions.
+// NOTE: Steps are counted per segment in st.segment_steps[] and folded into the int32 sys_position[]
+// when the segment completes. Probing, status reports and anything else needing the position in the
+// middle of a segment reads it through st_get_position().
 #ifdef STM32F103C8
 void TIM2_IRQHandler(void)
 #endif
@@ -380,15 +1180,25 @@ ISR(TIMER1_COMPA_vect)
 #endif
 {
 #ifdef STM32F103C8
-	if ((TIM2->SR & 0x0001) != 0)                  // check interrupt source
-	{
-		TIM2->SR &= ~(1 << 0);                          // clear UIF flag
-		TIM2->CNT = 0;
-	}
-	else
-	{
-		return;
-	}
+  uint32_t isr_start = DWT_CYCCNT;
+  #ifdef STEP_PER_AXIS_TIMING
+    if (st_timing.running) {
+      st_axis_isr();
+      st_record_isr_cycles(DWT_CYCCNT - isr_start);
+      return;
+    }
+  #endif
+  uint16_t status = TIM2->SR;
+  // The Stepper Port Reset, on the channel 4 compare. Also ends a pulse the compare missed, because
+  // a tick came before the pulse time, ahead of the next step.
+  if ((TIM2->DIER & TIM_DIER_CC4IE) && (status & (TIM_SR_CC4IF | TIM_SR_UIF))) {
+    TIM2->DIER &= ~TIM_DIER_CC4IE;
+    STEP_PORT->BSRR = st_bsrr(STEP_MASK, step_port_invert_mask);
+  }
+  if (!(status & TIM_SR_UIF)) { return; }
+  // The counter restarts from the update event in hardware, so the tick period stays exact and
+  // TIM2->CNT is the interrupt latency.
+  TIM2->SR = (uint16_t)~(TIM_SR_UIF | TIM_SR_CC4IF); // rc_w0. Writing ones leaves other flags.
 #endif
 
   if (busy) { return; } // The busy-flag is used to avoid reentering this interrupt
@@ -397,8 +1207,7 @@ ISR(TIMER1_COMPA_vect)
   DIRECTION_PORT = (DIRECTION_PORT & ~DIRECTION_MASK) | (st.dir_outbits & DIRECTION_MASK);
 #endif
 #ifdef STM32F103C8
-  GPIO_Write(DIRECTION_PORT, (GPIO_ReadOutputData(DIRECTION_PORT) & ~DIRECTION_MASK) | (st.dir_outbits & DIRECTION_MASK));
-  TIM_ClearITPendingBit(TIM3, TIM_IT_Update);
+  DIRECTION_PORT->BSRR = st_bsrr(DIRECTION_MASK, st.dir_outbits);
 #endif
 
   // Then pulse the stepping pins
@@ -409,7 +1218,7 @@ ISR(TIMER1_COMPA_vect)
     STEP_PORT = (STEP_PORT & ~STEP_MASK) | st.step_outbits;
 #endif
 #ifdef STM32F103C8
-	GPIO_Write(STEP_PORT, (GPIO_ReadOutputData(STEP_PORT) & ~STEP_MASK) | st.step_outbits);
+    STEP_PORT->BSRR = st_bsrr(STEP_MASK, st.step_outbits);
 #endif
   #endif
 
@@ -421,7 +1230,11 @@ ISR(TIMER1_COMPA_vect)
 #endif
 
 #ifdef STM32F103C8
-  NVIC_EnableIRQ(TIM3_IRQn);
+  if (st.step_outbits ^ step_port_invert_mask) { TIM2->DIER |= TIM_DIER_CC4IE; }
+  #ifdef DEBUG
+    uint32_t latency = TIM2->CNT*(TIM2->PSC + 1);
+    if (latency > st_isr_latency_max) { st_isr_latency_max = latency; }
+  #endif
 #endif
 
   busy = true;
@@ -433,9 +1246,7 @@ ISR(TIMER1_COMPA_vect)
   // If there is no step segment, attempt to pop one from the stepper buffer
   if (st.exec_segment == NULL) {
     // Anything in the buffer? If so, load and initialize next step segment.
-    if (segment_buffer_head != segment_buffer_tail) {
-      // Initialize new step segment and load number of steps to execute
-      st.exec_segment = &segment_buffer[segment_buffer_tail];
+    if (st_load_segment()) {
 
       #ifndef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
         // With AMASS is disabled, set timer prescaler for segments with slow step frequencies (< 250Hz).
@@ -444,41 +1255,14 @@ ISR(TIMER1_COMPA_vect)
 #endif
       #endif
 
-      // Initialize step segment timing per step and load number of steps to execute.
+      // Initialize step segment timing per step.
 #ifdef AVRTARGET
       OCR1A = st.exec_segment->cycles_per_tick;
 #endif
 
 #ifdef STM32F103C8
-	  TIM2->ARR = st.exec_segment->cycles_per_tick - 1;
-	  /* Set the Autoreload value */
-#ifndef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING        
-	  TIM2->PSC = st.exec_segment->prescaler;
-#endif
+      st_set_segment_timer();
 #endif
-      st.step_count = st.exec_segment->n_step; // NOTE: Can sometimes be zero when moving slow.
-      // If the new segment starts a new planner block, initialize stepper variables and counters.
-      // NOTE: When the segment data index changes, this indicates a new planner block.
-      if ( st.exec_block_index != st.exec_segment->st_block_index ) {
-        st.exec_block_index = st.exec_segment->st_block_index;
-        st.exec_block = &st_block_buffer[st.exec_block_index];
-
-        // Initialize Bresenham line and distance counters
-        st.counter_x = st.counter_y = st.counter_z = (st.exec_block->step_event_count >> 1);
-      }
-      st.dir_outbits = st.exec_block->direction_bits ^ dir_port_invert_mask;
-
-      #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-        // With AMASS enabled, adjust Bresenham axis increment counters according to AMASS level.
-        st.steps[X_AXIS] = st.exec_block->steps[X_AXIS] >> st.exec_segment->amass_level;
-        st.steps[Y_AXIS] = st.exec_block->steps[Y_AXIS] >> st.exec_segment->amass_level;
-        st.steps[Z_AXIS] = st.exec_block->steps[Z_AXIS] >> st.exec_segment->amass_level;
-      #endif
-
-      #ifdef VARIABLE_SPINDLE
-        // Set real-time spindle output as segment is loaded, just prior to the first step.
-        spindle_set_speed(st.exec_segment->spindle_pwm);
-      #endif
 
     } else {
       // Segment buffer empty. Shutdown.
@@ -496,59 +1280,12 @@ ISR(TIMER1_COMPA_vect)
   // Check probing state.
   if (sys_probe_state == PROBE_ACTIVE) { probe_state_monitor(); }
 
-  // Reset step out bits.
-  st.step_outbits = 0;
-
-  // Execute step displacement profile by Bresenham line algorithm
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_x += st.steps[X_AXIS];
-  #else
-    st.counter_x += st.exec_block->steps[X_AXIS];
-  #endif
-  if (st.counter_x > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<X_STEP_BIT);
-    st.counter_x -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<X_DIRECTION_BIT)) { sys_position[X_AXIS]--; }
-    else { sys_position[X_AXIS]++; }
-  }
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_y += st.steps[Y_AXIS];
-  #else
-    st.counter_y += st.exec_block->steps[Y_AXIS];
-  #endif
-  if (st.counter_y > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<Y_STEP_BIT);
-    st.counter_y -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<Y_DIRECTION_BIT)) { sys_position[Y_AXIS]--; }
-    else { sys_position[Y_AXIS]++; }
-  }
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_z += st.steps[Z_AXIS];
-  #else
-    st.counter_z += st.exec_block->steps[Z_AXIS];
-  #endif
-  if (st.counter_z > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<Z_STEP_BIT);
-    st.counter_z -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<Z_DIRECTION_BIT)) { sys_position[Z_AXIS]--; }
-    else { sys_position[Z_AXIS]++; }
-  }
-
-  // During a homing cycle, lock out and prevent desired axes from moving.
-  if (sys.state == STATE_HOMING) { st.step_outbits &= sys.homing_axis_lock; }
-
-  st.step_count--; // Decrement step events count
-  if (st.step_count == 0) {
-    // Segment is complete. Discard current segment and advance segment indexing.
-    st.exec_segment = NULL;
-	uint8_t segment_tail_next = segment_buffer_tail + 1;
-	if (segment_tail_next == SEGMENT_BUFFER_SIZE)
-		segment_tail_next = 0;
-	segment_buffer_tail = segment_tail_next;
-  }
-
+  st.step_outbits = st_bresenham_tick();
   st.step_outbits ^= step_port_invert_mask;  // Apply step port invert mask
   busy = false;
+#ifdef STM32F103C8
+  st_record_isr_cycles(DWT_CYCCNT - isr_start);
+#endif
 }
 
 
@@ -563,28 +1300,15 @@ ISR(TIMER1_COMPA_vect)
 // This interrupt is enabled by ISR_TIMER1_COMPAREA when it sets the motor port bits to execute
 // a step. This ISR resets the motor port after a short period (settings.pulse_microseconds)
 // completing one step cycle.
-#ifdef STM32F103C8
-void TIM3_IRQHandler(void)
-#endif
+// On the STM32, the TIM2 channel 4 compare in the Stepper Driver Interrupt resets the port instead.
 #ifdef AVRTARGET
 ISR(TIMER0_OVF_vect)
-#endif
 {
-#ifdef STM32F103C8
-	if ((TIM3->SR & 0x0001) != 0)                  // check interrupt source
-	{
-		TIM3->SR &= ~(1<<0);                          // clear UIF flag
-		TIM3->CNT = 0;
-		NVIC_DisableIRQ(TIM3_IRQn);
-		GPIO_Write(STEP_PORT, (GPIO_ReadOutputData(STEP_PORT) & ~STEP_MASK) | (step_port_invert_mask & STEP_MASK));
-	}
-#endif
-#ifdef AVRTARGET
   // Reset stepping pins (leave the direction pins)
   STEP_PORT = (STEP_PORT & ~STEP_MASK) | (step_port_invert_mask & STEP_MASK);
   TCCR0B = 0; // Disable Timer0 to prevent re-entering this interrupt when it's not needed.
-#endif
 }
+#endif
 #ifdef STEP_PULSE_DELAY
   // This interrupt is used only when STEP_PULSE_DELAY is enabled. Here, the step pulse is
   // initiated after the STEP_PULSE_DELAY time period has elapsed. The ISR TIMER2_OVF interrupt
@@ -617,9 +1341,15 @@ void st_reset()
   // Initialize stepper driver idle state.
   st_go_idle();
 
+  // Keep the steps of a segment cut short, before the segment data is cleared.
+  if (st.exec_block != NULL) { st_fold_segment_steps(); }
+
   // Initialize stepper algorithm variables.
   memset(&prep, 0, sizeof(st_prep_t));
   memset(&st, 0, sizeof(stepper_t));
+  #ifdef INPUT_SHAPING
+    st_shaper_init();
+  #endif
   st.exec_segment = NULL;
   pl_block = NULL;  // Planner block pointer used by segment buffer
   segment_buffer_tail = 0;
@@ -663,10 +1393,25 @@ void stepper_init()
 
 	RCC->APB1ENR |= RCC_APB1Periph_TIM2;
 	TIM_Configuration(TIM2, 1, 1, 1);
-	RCC->APB1ENR |= RCC_APB1Periph_TIM3;
-	TIM_Configuration(TIM3, 1, 1, 1);
-	NVIC_DisableIRQ(TIM3_IRQn);
-	NVIC_DisableIRQ(TIM2_IRQn);
+	TIM2->DIER = 0; // Update and compare interrupts are enabled by st_wake_up() and each step.
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+#ifdef STEP_DMA_BSRR
+	// TIM4 update events request the DMA transfers. Its period is set in st_dma_start().
+	RCC->AHBENR |= RCC_AHBPeriph_DMA1;
+	RCC->APB1ENR |= RCC_APB1Periph_TIM4;
+	TIM4->PSC = 0;
+	TIM4->CR1 = 0;
+
+	NVIC_InitTypeDef NVIC_InitStructure;
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel7_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1; // Same as the stepper interrupt
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 1;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+#endif
 #endif
 #ifdef AVRTARGET
   STEP_DDR |= STEP_MASK;
@@ -693,11 +1438,312 @@ void stepper_init()
 }
 
 
+// Returns the machine position in motor steps at this instant, sys_position[] plus the steps of the
+// executing segment. The step generator interrupts are held off for a consistent copy, so this may
+// be called from the main program and from those interrupts alike.
+void st_get_position(int32_t *position)
+{
+  #ifdef STM32F103C8
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+  #endif
+  #ifdef AVRTARGET
+    uint8_t sreg = SREG;
+    cli();
+  #endif
+  memcpy(position, sys_position, sizeof(sys_position));
+  if (st.exec_block != NULL) {
+    uint8_t idx;
+    for (idx=0; idx<N_AXIS; idx++) {
+      if (st.exec_block->direction_bits & direction_pin_mask[idx]) { position[idx] -= st.segment_steps[idx]; }
+      else { position[idx] += st.segment_steps[idx]; }
+    }
+  }
+  #ifdef STM32F103C8
+    __set_PRIMASK(primask);
+  #endif
+  #ifdef AVRTARGET
+    SREG = sreg;
+  #endif
+}
+
+
+#ifdef S_CURVE_ACCELERATION
+  // Returns the distance traveled from the start of the S-curve ramp at time t of the ramp.
+  static float st_scurve_distance(float t)
+  {
+    float tau = prep.s_jerk_time;
+    float r = prep.s_duration-t;
+    float gain; // Distance gained over traveling at the start speed
+    if (t < tau) { gain = prep.s_peak_accel*t*t*t/(6.0f*tau); } // Rising acceleration
+    else if (r < tau) { gain = prep.s_delta_speed*(0.5f*prep.s_duration-r) + prep.s_peak_accel*r*r*r/(6.0f*tau); } // Falling
+    else { gain = prep.s_peak_accel*(tau*tau/6.0f + 0.5f*t*(t-tau)); } // Peak acceleration
+    if (prep.s_decelerate) { return(prep.s_start_speed*t - gain); }
+    return(prep.s_start_speed*t + gain);
+  }
+
+
+  // Returns the speed at time t of the S-curve ramp.
+  static float st_scurve_speed(float t)
+  {
+    float tau = prep.s_jerk_time;
+    float r = prep.s_duration-t;
+    float gain;
+    if (t < tau) { gain = 0.5f*prep.s_peak_accel*t*t/tau; }
+    else if (r < tau) { gain = prep.s_delta_speed - 0.5f*prep.s_peak_accel*r*r/tau; }
+    else { gain = prep.s_peak_accel*(t-0.5f*tau); }
+    if (prep.s_decelerate) { return(max(prep.s_start_speed-gain, 0.0f)); }
+    return(prep.s_start_speed+gain);
+  }
+
+
+  // Returns the time of the ramp, between t_lo and t_hi, at which it has traveled the given distance.
+  static float st_scurve_time_at(float t_lo, float t_hi, float distance)
+  {
+    uint8_t i;
+    for (i=0; i<S_CURVE_BISECTIONS; i++) {
+      float t = 0.5f*(t_lo+t_hi);
+      if (st_scurve_distance(t) < distance) { t_lo = t; }
+      else { t_hi = t; }
+    }
+    return(t_hi);
+  }
+
+
+  // Returns the speed squared of the trapezoidal profile of pl_block at the end of the segment buffer.
+  static float st_scurve_profile_speed_sqr()
+  {
+    float speed_sqr;
+    float accel_2 = 2.0f*pl_block->acceleration;
+    switch (prep.ramp_type) {
+      case RAMP_ACCEL:
+        speed_sqr = prep.maximum_speed*prep.maximum_speed - accel_2*(pl_block->millimeters-prep.accelerate_until);
+        break;
+      case RAMP_DECEL_OVERRIDE:
+        speed_sqr = prep.maximum_speed*prep.maximum_speed + accel_2*(pl_block->millimeters-prep.accelerate_until);
+        break;
+      case RAMP_CRUISE: return(prep.maximum_speed*prep.maximum_speed);
+      default: // case RAMP_DECEL:
+        speed_sqr = prep.exit_speed*prep.exit_speed + accel_2*(pl_block->millimeters-prep.mm_complete);
+    }
+    return(max(speed_sqr, 0.0f));
+  }
+
+
+  // Walks the ramp of the profile of pl_block from the end of the segment buffer, on through the
+  // following planner blocks for as long as their profiles, as st_prep_segments() computes them, keep
+  // ramping the same way. Returns the block the ramp ends in, or NULL if the profile is cruising, and
+  // sets the length, end speed and jerk limit of the ramp. A ramp only continues through a block if
+  // its speed stays within the junction and nominal speed limits, which a decelerating ramp checks
+  // against its start speed. Feed holds and override decelerations are forced and ignore them, as
+  // with the constant acceleration profiles.
+  static plan_block_t *st_scurve_walk(float start_speed, float *distance, float *end_speed, float *jerk)
+  {
+    float speed;
+    float piece_end; // End of the ramp in the block, measured from the end of the block (mm)
+    switch (prep.ramp_type) {
+      case RAMP_CRUISE: return(NULL);
+      case RAMP_ACCEL: case RAMP_DECEL_OVERRIDE:
+        piece_end = prep.accelerate_until;
+        speed = prep.maximum_speed;
+        break;
+      default: // case RAMP_DECEL:
+        piece_end = prep.mm_complete;
+        speed = prep.exit_speed;
+    }
+    plan_block_t *block = pl_block;
+    *distance = block->millimeters-piece_end;
+    *jerk = block->jerk;
+    if ((piece_end > 0.0f) || (prep.ramp_type == RAMP_DECEL_OVERRIDE) ||
+        (sys.step_control & STEP_CONTROL_EXECUTE_SYS_MOTION)) {
+      *end_speed = speed; // Ramp ends within the block, or the system motion block is the only one.
+      return(block);
+    }
+
+    uint8_t hold = sys.step_control & STEP_CONTROL_EXECUTE_HOLD;
+    uint8_t decel_override = prep.recalculate_flag & PREP_FLAG_DECEL_OVERRIDE;
+    float start_speed_sqr = start_speed*start_speed;
+    float limit_sqr = SOME_LARGE_VALUE;
+    plan_block_t *next;
+    while ((next = plan_get_next_block(block)) != NULL) {
+      float inv_2_accel = 0.5f/next->acceleration;
+      float piece = next->millimeters;
+      float next_speed;
+      uint8_t ramp_ends = false;
+      if (hold || decel_override) {
+        // Forced deceleration. Loaded with the exit speed of the previous block as entry speed.
+        float entry_speed_sqr = speed*speed;
+        if (hold) {
+          float decel_dist = piece - inv_2_accel*entry_speed_sqr;
+          if (decel_dist < 0.0f) { next_speed = sqrtf(entry_speed_sqr-2*next->acceleration*piece); }
+          else {
+            piece -= decel_dist; // End of feed hold.
+            next_speed = 0.0f;
+            ramp_ends = true;
+          }
+        } else {
+          float nominal_speed = plan_compute_profile_nominal_speed(next);
+          float nominal_speed_sqr = nominal_speed*nominal_speed;
+          if (entry_speed_sqr <= nominal_speed_sqr) { break; } // Override deceleration ends at the junction.
+          float accelerate_until = piece - inv_2_accel*(entry_speed_sqr-nominal_speed_sqr);
+          if (accelerate_until <= 0.0f) { next_speed = sqrtf(entry_speed_sqr-2*next->acceleration*piece); }
+          else {
+            piece -= accelerate_until;
+            next_speed = nominal_speed;
+            ramp_ends = true;
+          }
+        }
+      } else {
+        float nominal_speed = plan_compute_profile_nominal_speed(next);
+        float nominal_speed_sqr = nominal_speed*nominal_speed;
+        if (next->entry_speed_sqr > nominal_speed_sqr) { break; } // Override reduction. Ramps on its own.
+        float exit_speed_sqr = 0.0f;
+        plan_block_t *after = plan_get_next_block(next);
+        if (after != NULL) { exit_speed_sqr = after->entry_speed_sqr; }
+        float intersect_distance = 0.5f*(piece+inv_2_accel*(next->entry_speed_sqr-exit_speed_sqr));
+        float block_limit_sqr = min(next->max_entry_speed_sqr, nominal_speed_sqr);
+        if (prep.ramp_type == RAMP_ACCEL) {
+          if (intersect_distance > 0.0f) {
+            // Acceleration ends in this block, unless it does not accelerate at all.
+            if (intersect_distance >= piece) { break; } // Deceleration-only type
+            if (inv_2_accel*(nominal_speed_sqr-exit_speed_sqr) < intersect_distance) { // Trapezoid type
+              if (next->entry_speed_sqr == nominal_speed_sqr) { break; } // Cruise type
+              piece = inv_2_accel*(nominal_speed_sqr-next->entry_speed_sqr);
+              next_speed = nominal_speed;
+            } else { // Triangle type
+              piece -= intersect_distance;
+              next_speed = sqrtf(2.0f*next->acceleration*intersect_distance+exit_speed_sqr);
+            }
+            ramp_ends = true;
+          } else { // Acceleration-only type
+            next_speed = sqrtf(exit_speed_sqr);
+          }
+          limit_sqr = min(limit_sqr, block_limit_sqr);
+          if (next_speed*next_speed > limit_sqr) { break; }
+        } else {
+          if (intersect_distance < piece) { break; } // Not a deceleration-only type. Ends at the junction.
+          if (block_limit_sqr < start_speed_sqr) { break; }
+          next_speed = sqrtf(exit_speed_sqr);
+        }
+      }
+      *distance += piece;
+      *jerk = min(*jerk, next->jerk);
+      speed = next_speed;
+      block = next;
+      if (ramp_ends) { break; }
+    }
+    // A feed hold may run out of blocks, if it starts above the planned speed from the top of a ramp.
+    // It stops at the end of the last block then, at a little more than the planned deceleration.
+    if (hold) { speed = 0.0f; }
+    *end_speed = speed;
+    return(block);
+  }
+
+
+  // Starts an S-curve ramp at the end of the segment buffer, from the current speed at zero
+  // acceleration. Returns false, if the profile of pl_block is not ramping or the jerk is unlimited.
+  static uint8_t st_scurve_start()
+  {
+    if (!(pl_block->jerk < SOME_LARGE_VALUE)) { return(false); }
+    float distance, end_speed, jerk;
+    plan_block_t *last_block = st_scurve_walk(prep.current_speed, &distance, &end_speed, &jerk);
+    float speed_sum = prep.current_speed+end_speed;
+    if ((last_block == NULL) || !(distance > 0.0f) || !(speed_sum > 0.0f)) { return(false); }
+    prep.s_last_block = last_block;
+    prep.s_decelerate = (end_speed < prep.current_speed);
+    prep.s_start_speed = prep.current_speed;
+    prep.s_end_speed = end_speed;
+    prep.s_delta_speed = fabsf(end_speed-prep.current_speed);
+    prep.s_distance = distance;
+    prep.s_duration = 2.0f*distance/speed_sum;
+    float discriminant = prep.s_duration*prep.s_duration - 4.0f*prep.s_delta_speed/jerk;
+    if (discriminant > 0.0f) { prep.s_jerk_time = 0.5f*(prep.s_duration-sqrtf(discriminant)); }
+    else { prep.s_jerk_time = 0.5f*prep.s_duration; } // Too short for the jerk limit.
+    prep.s_peak_accel = prep.s_delta_speed/(prep.s_duration-prep.s_jerk_time);
+    prep.s_time = 0.0f;
+    prep.s_traveled = 0.0f;
+    return(true);
+  }
+
+
+  // Checks the ramp in progress against the profile of pl_block, as it is loaded or replanned.
+  // Returns true, if the ramp still ends where and at the speed the planner has it end.
+  static uint8_t st_scurve_continues()
+  {
+    if (prep.s_decelerate == (prep.ramp_type == RAMP_ACCEL)) { return(false); }
+    float distance, end_speed, jerk;
+    if (st_scurve_walk(prep.s_start_speed, &distance, &end_speed, &jerk) != prep.s_last_block) { return(false); }
+    if (fabsf(distance-(prep.s_distance-prep.s_traveled)) > S_CURVE_TOLERANCE*prep.s_distance+prep.req_mm_increment) {
+      return(false);
+    }
+    return(fabsf(end_speed-prep.s_end_speed) <= S_CURVE_TOLERANCE*(prep.s_start_speed+prep.s_end_speed));
+  }
+
+
+  // Computes a segment on the S-curve ramp, in place of the constant acceleration ramp cases of
+  // st_prep_segments(). Advances over time_var, or up to where the ramp ends in pl_block, and sets
+  // time_var and mm_remaining as those cases do. Returns false, if there is no ramp to trace.
+  static uint8_t st_scurve_segment(float *time_var, float *mm_remaining)
+  {
+    if (prep.ramp_type == RAMP_CRUISE) { return(false); }
+    if (prep.s_last_block == NULL) {
+      if (!st_scurve_start()) { return(false); }
+    }
+    float piece_end = prep.mm_complete;
+    if ((prep.ramp_type == RAMP_ACCEL) || (prep.ramp_type == RAMP_DECEL_OVERRIDE)) { piece_end = prep.accelerate_until; }
+    float ramp_mm = prep.s_traveled + (*mm_remaining-piece_end); // Ramp distance at the piece end.
+    float t = prep.s_time + *time_var;
+    if (t > prep.s_duration) { t = prep.s_duration; }
+    float traveled = st_scurve_distance(t);
+    if ((traveled < ramp_mm) && (t < prep.s_duration)) { // Mid-ramp
+      *mm_remaining -= traveled-prep.s_traveled;
+      prep.current_speed = st_scurve_speed(t);
+      prep.s_time = t;
+      prep.s_traveled = traveled;
+      return(true);
+    }
+
+    // End of the ramp in this block.
+    if (traveled > ramp_mm) { t = st_scurve_time_at(prep.s_time, t, ramp_mm); }
+    *time_var = t-prep.s_time;
+    *mm_remaining = piece_end;
+    prep.s_time = t;
+    prep.s_traveled = ramp_mm;
+    if ((pl_block != prep.s_last_block) && (t < prep.s_duration)) {
+      prep.current_speed = st_scurve_speed(t); // Ramp continues in the next block.
+      return(true);
+    }
+    prep.s_last_block = NULL; // End of the ramp. Progress as the constant acceleration ramps do.
+    switch (prep.ramp_type) {
+      case RAMP_ACCEL:
+        if (*mm_remaining == prep.decelerate_after) { prep.ramp_type = RAMP_DECEL; }
+        else { prep.ramp_type = RAMP_CRUISE; }
+        prep.current_speed = prep.maximum_speed;
+        break;
+      case RAMP_DECEL_OVERRIDE:
+        prep.ramp_type = RAMP_CRUISE;
+        prep.current_speed = prep.maximum_speed;
+        break;
+      default: // case RAMP_DECEL:
+        prep.current_speed = prep.exit_speed;
+    }
+    return(true);
+  }
+#endif
+
+
 // Called by planner_recalculate() when the executing block is updated by the new plan.
 void st_update_plan_block_parameters()
 {
   if (pl_block != NULL) { // Ignore if at start of a new block.
     prep.recalculate_flag |= PREP_FLAG_RECALCULATE;
+    #ifdef S_CURVE_ACCELERATION
+      if (prep.s_last_block != NULL) {
+        // Replan from the speed of the trapezoidal profile the ramp traces, so the same profile is
+        // recomputed if the plan of this block has not changed, and the ramp carries on.
+        pl_block->entry_speed_sqr = st_scurve_profile_speed_sqr();
+      } else
+    #endif
     pl_block->entry_speed_sqr = prep.current_speed*prep.current_speed; // Update entry speed.
     pl_block = NULL; // Flag st_prep_segment() to load and check active velocity profile.
   }
@@ -708,11 +1754,64 @@ void st_update_plan_block_parameters()
 static uint8_t st_next_block_index(uint8_t block_index)
 {
   block_index++;
-  if ( block_index == (SEGMENT_BUFFER_SIZE-1) ) { return(0); }
+  if ( block_index == ST_BLOCK_BUFFER_SIZE ) { return(0); }
   return(block_index);
 }
 
 
+// Sets the step timing of a prepped segment from its time per step, inv_rate (min/step). With AMASS,
+// this also scales its step count to the AMASS level.
+static void st_set_segment_rate(segment_t *prep_segment, float inv_rate)
+{
+  // Compute CPU cycles per step for the prepped segment.
+  uint32_t cycles = (uint32_t)ceilf((TICKS_PER_MICROSECOND * 1000000) *inv_rate * 60); // (cycles/step)
+
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    // Compute step timing and multi-axis smoothing level.
+    // NOTE: AMASS overdrives the timer with each level, so only one prescalar is required.
+    if (cycles < AMASS_LEVEL1) { prep_segment->amass_level = 0; }
+    else {
+      if (cycles < AMASS_LEVEL2) { prep_segment->amass_level = 1; }
+      else if (cycles < AMASS_LEVEL3) { prep_segment->amass_level = 2; }
+      else { prep_segment->amass_level = 3; }
+      cycles >>= prep_segment->amass_level;
+      prep_segment->n_step <<= prep_segment->amass_level;
+    }
+    #ifdef AVRTARGET
+    if (cycles < (1UL << 16)) { prep_segment->cycles_per_tick = cycles; } // < 65536 (4.1ms @ 16MHz)
+    else { prep_segment->cycles_per_tick = 0xffff; } // Just set the slowest speed possible.
+    #endif
+  #elif defined(AVRTARGET)
+    // Compute step timing and timer prescalar for normal step generation.
+    if (cycles < (1UL << 16)) { // < 65536  (4.1ms @ 16MHz)
+      prep_segment->prescaler = 1; // prescaler: 0
+      prep_segment->cycles_per_tick = cycles;
+    } else if (cycles < (1UL << 19)) { // < 524288 (32.8ms@16MHz)
+      prep_segment->prescaler = 2; // prescaler: 8
+      prep_segment->cycles_per_tick = cycles >> 3;
+    } else {
+      prep_segment->prescaler = 3; // prescaler: 64
+      if (cycles < (1UL << 22)) { // < 4194304 (262ms@16MHz)
+        prep_segment->cycles_per_tick =  cycles >> 6;
+      } else { // Just set the slowest speed possible. (Around 4 step/sec.)
+        prep_segment->cycles_per_tick = 0xffff;
+      }
+    }
+  #endif
+  #ifdef STM32F103C8
+    // The 16-bit timer runs out at 910usec at 72MHz, which would cap the step rate at 137Hz even at
+    // AMASS level 3. Slower ticks divide the timer clock by powers of two instead.
+    prep_segment->prescaler = 0;
+    while ((cycles >= (1UL << 16)) && (prep_segment->prescaler < STEP_TIMER_MAX_PRESCALER)) {
+      cycles >>= 1;
+      prep_segment->prescaler++;
+    }
+    if (cycles < (1UL << 16)) { prep_segment->cycles_per_tick = cycles; }
+    else { prep_segment->cycles_per_tick = 0xffff; } // Just set the slowest speed possible.
+  #endif
+}
+
+
 #ifdef PARKING_ENABLE
   // Changes the run state of the step segment buffer to execute the special parking motion.
   void st_parking_setup_buffer()
@@ -727,6 +1826,9 @@ static uint8_t st_next_block_index(uint8_t block_index)
     // Set flags to execute a parking motion
     prep.recalculate_flag |= PREP_FLAG_PARKING;
     prep.recalculate_flag &= ~(PREP_FLAG_RECALCULATE);
+    #ifdef S_CURVE_ACCELERATION
+      prep.s_last_block = NULL;
+    #endif
     pl_block = NULL; // Always reset parking motion to reload new block.
   }
 
@@ -746,11 +1848,229 @@ static uint8_t st_next_block_index(uint8_t block_index)
     } else {
       prep.recalculate_flag = false;
     }
+    #ifdef S_CURVE_ACCELERATION
+      prep.s_last_block = NULL;
+    #endif
     pl_block = NULL; // Set to reload next block.
   }
 #endif
 
 
+#ifdef INPUT_SHAPING
+/* INPUT SHAPER
+   The input shaper retimes the prepped segments on their way to the segment buffer. It convolves
+   the commanded speed along the path v(t) with two or three impulses, so the executed speed is
+   sum(A_i*v(t-t_i)). For a resonance of frequency f and damping ratio z, with the damped period
+   Td = 1/(f*sqrt(1-z^2)) and K = exp(-z*pi/sqrt(1-z^2)):
+     ZV:   A = [1, K]/(1+K),           t = [0, Td/2]
+     ZVD:  A = [1, 2K, K^2]/(1+K)^2,   t = [0, Td/2, Td]
+   The ringing each impulse excites is cancelled by that of the later ones. Only the segment times
+   change. The path, the segment steps and their blocks do not, so the steps stay exact.
+
+   The queued segments are the commanded motion, at constant speed over each. An impulse cursor
+   follows the commanded motion at the delayed time t-t_i of its impulse. The output segment is
+   timed by moving the cursors on together, from one segment end to the next, until the shaped
+   distance covers the segment. The first cursor has to reach the end of the segment first, so the
+   shaper holds back segments up to its duration ahead of the output, and keeps those up to its
+   duration behind it for the last cursor.
+   A commanded motion that ends, at the end of the planner buffer, a feed hold or a system motion,
+   ends at rest, so the held back segments are output right away. The cursors then wait for the
+   next motion, as after a reset. The time no cursor moves is left out of the segment times, so the
+   next motion follows on at once, but never overlaps the end of the last.
+*/
+
+// Sets up the shaper impulses from the shaper settings, and empties the shaper. Returns false, if
+// the settings do not give a shaper, which is then off.
+uint8_t st_shaper_init()
+{
+  uint8_t valid = true;
+  shaper.n_impulses = 1;
+  shaper.amplitude[0] = 1.0f;
+  shaper.delay[0] = 0.0f;
+  if (settings.shaper_type != SHAPER_OFF) {
+    float damping = settings.shaper_damping;
+    valid = false;
+    if ((settings.shaper_type <= SHAPER_ZVD) && (settings.shaper_frequency > 0.0f) &&
+        (damping >= 0.0f) && (damping < 1.0f)) {
+      float root = sqrtf(1.0f-damping*damping);
+      float k = expf(-(float)M_PI*damping/root);
+      float half_period = 0.5f/(60.0f*settings.shaper_frequency*root); // (min)
+      if (settings.shaper_type == SHAPER_ZV) {
+        shaper.n_impulses = 2;
+        shaper.amplitude[0] = 1.0f/(1.0f+k);
+        shaper.amplitude[1] = k*shaper.amplitude[0];
+      } else {
+        shaper.n_impulses = 3;
+        shaper.amplitude[0] = 1.0f/((1.0f+k)*(1.0f+k));
+        shaper.amplitude[1] = 2.0f*k*shaper.amplitude[0];
+        shaper.amplitude[2] = k*k*shaper.amplitude[0];
+        shaper.delay[2] = 2.0f*half_period;
+      }
+      shaper.delay[1] = half_period;
+      valid = (shaper.delay[shaper.n_impulses-1] <= SHAPER_MAX_DELAY);
+    }
+    if (!valid) {
+      shaper.n_impulses = 1;
+      shaper.amplitude[0] = 1.0f;
+    }
+  }
+
+  shaper.tail = 0;
+  shaper.output = 0;
+  shaper.head = 0;
+  uint8_t i;
+  for (i=0; i<shaper.n_impulses; i++) {
+    shaper.cursor[i] = 0;
+    shaper.cursor_time[i] = -shaper.delay[i];
+  }
+  shaper.started = false;
+  shaper.remaining = 0.0f;
+  shaper.st_block_index = prep.st_block_index;
+  shaper.dt_remainder = 0.0f;
+  return(valid);
+}
+
+
+static uint8_t st_shaper_next(uint8_t index)
+{
+  if (++index == SHAPER_BUFFER_SIZE) { return(0); }
+  return(index);
+}
+
+
+// Times the output segment, moving the impulse cursors on to where the shaped motion ends it.
+// Returns false, if the commanded motion is not prepped that far yet. Picks up where it left off.
+static uint8_t st_shaper_time_segment(uint8_t mode)
+{
+  if (!shaper.started) {
+    shaper.remaining += shaper.segment[shaper.output].mm;
+    shaper.duration = 0.0f;
+    shaper.started = true;
+  }
+  uint8_t i;
+  while (1) {
+    float speed = 0.0f;              // Shaped speed
+    float time = SOME_LARGE_VALUE;   // Until the next cursor reaches the end of its segment
+    for (i=0; i<shaper.n_impulses; i++) {
+      uint8_t c = shaper.cursor[i];
+      while ((c != shaper.head) && (shaper.cursor_time[i] >= shaper.segment[c].dt)) {
+        shaper.cursor_time[i] -= shaper.segment[c].dt;
+        c = st_shaper_next(c);
+      }
+      shaper.cursor[i] = c;
+      if (shaper.cursor_time[i] < 0.0f) { // At rest before the motion starts.
+        time = min(time, -shaper.cursor_time[i]);
+      } else if (c != shaper.head) {
+        speed += shaper.amplitude[i]*shaper.segment[c].speed;
+        time = min(time, shaper.segment[c].dt-shaper.cursor_time[i]);
+      } else if (mode == SHAPER_WAIT) {
+        return(false);
+      } else if (mode == SHAPER_EXTRAPOLATE) {
+        c = ((shaper.head == 0) ? SHAPER_BUFFER_SIZE : shaper.head) - 1;
+        speed += shaper.amplitude[i]*shaper.segment[c].speed;
+      } // Otherwise, at rest after the motion stops.
+    }
+
+    uint8_t complete = false;
+    if (speed > 0.0f) {
+      if (speed*time >= shaper.remaining) {
+        time = shaper.remaining/speed;
+        complete = true;
+      }
+      shaper.remaining -= speed*time;
+      shaper.duration += time;
+    } else if (time == SOME_LARGE_VALUE) {
+      complete = true; // All cursors at rest past the end. Only round-off is left.
+    }
+    if (complete) {
+      for (i=0; i<shaper.n_impulses; i++) { shaper.cursor_time[i] += ((speed > 0.0f) ? time : 0.0f); }
+      shaper.remaining = 0.0f;
+      shaper.started = false;
+      return(true);
+    }
+    for (i=0; i<shaper.n_impulses; i++) { shaper.cursor_time[i] += time; }
+  }
+}
+
+
+// Outputs the next queued segment to the segment buffer, once it is timed. Returns false, if there
+// is no segment to output or no room for it.
+static uint8_t st_shaper_output(uint8_t mode)
+{
+  if ((shaper.output == shaper.head) || (segment_buffer_tail == segment_next_head)) { return(false); }
+  if (!st_shaper_time_segment(mode)) { return(false); }
+
+  shaper_segment_t *shaped = &shaper.segment[shaper.output];
+  segment_t *prep_segment = &segment_buffer[segment_buffer_head];
+  memcpy(prep_segment, &shaped->segment, sizeof(segment_t));
+  if (prep_segment->st_block_index != shaper.st_block_index) {
+    shaper.st_block_index = prep_segment->st_block_index;
+    shaper.dt_remainder = 0.0f; // Reset for new segment block
+  }
+  // Same partial step rate correction as for an unshaped segment. See st_prep_segments().
+  float inv_rate = (shaper.duration + shaper.dt_remainder)/shaped->steps;
+  shaper.dt_remainder = shaped->partial_step*inv_rate;
+  st_set_segment_rate(prep_segment, inv_rate);
+
+  // Segment complete! Increment segment buffer indices, so stepper ISR can immediately execute it.
+  segment_buffer_head = segment_next_head;
+  if ( ++segment_next_head == SEGMENT_BUFFER_SIZE ) { segment_next_head = 0; }
+  shaper.output = st_shaper_next(shaper.output);
+
+  // Release the segments all cursors have passed.
+  while (shaper.tail != shaper.output) {
+    uint8_t i;
+    for (i=0; i<shaper.n_impulses; i++) {
+      if (shaper.cursor[i] == shaper.tail) { return(true); }
+    }
+    shaper.tail = st_shaper_next(shaper.tail);
+  }
+  return(true);
+}
+
+
+// Outputs the held back segments at the end of a commanded motion. Once all are out, the cursors
+// wait for the next motion to start.
+static void st_shaper_stop()
+{
+  while (st_shaper_output(SHAPER_STOP)) {}
+  if (shaper.output == shaper.head) {
+    uint8_t i;
+    for (i=0; i<shaper.n_impulses; i++) {
+      shaper.cursor[i] = shaper.head;
+      shaper.cursor_time[i] = -shaper.delay[i];
+    }
+    shaper.tail = shaper.head;
+  }
+}
+
+
+// Makes room in the full shaper buffer. Only happens with many segments much shorter than
+// DT_SEGMENT, like those of short blocks at speed. The two oldest segments behind the output are
+// merged into one at their mean speed, which slightly blurs the shaping. If the held back segments
+// fill the buffer, the next one is output as though the commanded motion went on at its last speed.
+static void st_shaper_make_room()
+{
+  uint8_t next = st_shaper_next(shaper.tail);
+  if ((shaper.tail == shaper.output) || (next == shaper.output)) {
+    st_shaper_output(SHAPER_EXTRAPOLATE);
+    return;
+  }
+  shaper_segment_t *first = &shaper.segment[shaper.tail];
+  shaper_segment_t *merged = &shaper.segment[next];
+  uint8_t i;
+  for (i=0; i<shaper.n_impulses; i++) {
+    if (shaper.cursor[i] == shaper.tail) { shaper.cursor[i] = next; }
+    else if (shaper.cursor[i] == next) { shaper.cursor_time[i] += first->dt; }
+  }
+  merged->dt += first->dt;
+  merged->mm += first->mm;
+  if (merged->dt > 0.0f) { merged->speed = merged->mm/merged->dt; }
+  shaper.tail = next;
+}
+#endif
+
+
 /* Prepares step segment buffer. Continuously called from main program.
 
    The segment buffer is an intermediary buffer interface between the execution of steps
@@ -761,23 +2081,43 @@ static uint8_t st_next_block_index(uint8_t block_index)
    The number of steps "checked-out" from the planner buffer and the number of segments in
    the segment buffer is sized and computed such that no operation in the main program takes
    longer than the time it takes the stepper algorithm to empty it before refilling it.
-   Currently, the segment buffer conservatively holds roughly up to 40-50 msec of steps.
+   Currently, the segment buffer conservatively holds roughly up to 40-50 msec of steps during
+   ramps, and more while cruising.
    NOTE: Computation units are in steps, millimeters, and minutes.
 */
-void st_prep_buffer()
+static void st_prep_segments()
 {
   // Block step prep buffer, while in a suspend state and there is no suspend motion to execute.
-  if (bit_istrue(sys.step_control,STEP_CONTROL_END_MOTION)) { return; }
+  if (bit_istrue(sys.step_control,STEP_CONTROL_END_MOTION)) {
+    #ifdef INPUT_SHAPING
+      st_shaper_stop(); // Finish the output of the motion that ended.
+    #endif
+    return;
+  }
 
   while (segment_buffer_tail != segment_next_head) { // Check if we need to fill the buffer.
 
+    #ifdef INPUT_SHAPING
+      // Output shaped segments first. Only prep more, when the shaper needs them to go on.
+      if (st_shaper_output(SHAPER_WAIT)) { continue; }
+      if (st_shaper_next(shaper.head) == shaper.tail) {
+        st_shaper_make_room();
+        continue;
+      }
+    #endif
+
     // Determine if we need to load a new planner block or if the block needs to be recomputed.
     if (pl_block == NULL) {
 
       // Query planner for a queued block
       if (sys.step_control & STEP_CONTROL_EXECUTE_SYS_MOTION) { pl_block = plan_get_system_motion_block(); }
       else { pl_block = plan_get_current_block(); }
-      if (pl_block == NULL) { return; } // No planner blocks. Exit.
+      if (pl_block == NULL) { // No planner blocks. Exit.
+        #ifdef INPUT_SHAPING
+          st_shaper_stop(); // The planned motion ends at rest.
+        #endif
+        return;
+      }
 
       // Check if we need to only recompute the velocity profile or load a new block.
       if (prep.recalculate_flag & PREP_FLAG_RECALCULATE) {
@@ -929,6 +2269,21 @@ void st_prep_buffer()
 					prep.maximum_speed = prep.exit_speed;
 				}
 			}
+
+      #ifdef S_CURVE_ACCELERATION
+        if (prep.s_last_block != NULL) {
+          // A block of the S-curve ramp in progress is loaded, or this block is replanned. The ramp
+          // carries on, if the plan is unchanged. Otherwise, replan the block from the ramp speed.
+          prep.current_speed = st_scurve_speed(prep.s_time);
+          if (!st_scurve_continues()) {
+            prep.s_last_block = NULL;
+            pl_block->entry_speed_sqr = prep.current_speed*prep.current_speed;
+            prep.recalculate_flag |= PREP_FLAG_RECALCULATE;
+            pl_block = NULL;
+            continue;
+          }
+        }
+      #endif
       
       #ifdef VARIABLE_SPINDLE
         bit_true(sys.step_control, STEP_CONTROL_UPDATE_SPINDLE_PWM); // Force update whenever updating block.
@@ -936,19 +2291,26 @@ void st_prep_buffer()
     }
     
     // Initialize new segment
-    segment_t *prep_segment = &segment_buffer[segment_buffer_head];
+    #ifdef INPUT_SHAPING
+      segment_t *prep_segment = &shaper.segment[shaper.head].segment;
+    #else
+      segment_t *prep_segment = &segment_buffer[segment_buffer_head];
+    #endif
 
     // Set new segment to point to the current segment data block.
     prep_segment->st_block_index = prep.st_block_index;
 
     /*------------------------------------------------------------------------------------
         Compute the average velocity of this new segment by determining the total distance
-      traveled over the segment time DT_SEGMENT. The following code first attempts to create
+      traveled over the segment time dt_max. The following code first attempts to create
       a full segment based on the current ramp conditions. If the segment time is incomplete
       when terminating at a ramp state change, the code will continue to loop through the
       progressing ramp states to fill the remaining segment execution time. However, if
       an incomplete segment terminates at the end of the velocity profile, the segment is
-      considered completed despite having a truncated execution time less than DT_SEGMENT.
+      considered completed despite having a truncated execution time less than dt_max.
+        The segment time is DT_SEGMENT in the acceleration and deceleration ramps, and up to
+      DT_SEGMENT_CRUISE while cruising, where a finer time step adds nothing to the profile.
+      A cruising segment running into a ramp ends DT_SEGMENT into the ramp at most.
         The velocity profile is always assumed to progress through the ramp sequence:
       acceleration ramp, cruising state, and deceleration ramp. Each ramp's travel distance
       may range from zero to the length of the block. Velocity profiles can end either at
@@ -956,15 +2318,23 @@ void st_prep_buffer()
       such as from a feed hold.
     */
     float dt_max = DT_SEGMENT; // Maximum segment time
+    if (prep.ramp_type == RAMP_CRUISE) { dt_max = DT_SEGMENT_CRUISE; } // Coarser at constant speed.
+    #ifdef S_CURVE_ACCELERATION
+      if (prep.s_last_block != NULL) { dt_max = DT_SEGMENT; } // S-curve ramp in progress
+    #endif
+    float speed_var = max(prep.current_speed, prep.maximum_speed)*prep.step_per_mm; // Speed worker variable
+    if (speed_var*dt_max > SEGMENT_MAX_STEPS) { dt_max = SEGMENT_MAX_STEPS/speed_var; } // Keep n_step in range.
     float dt = 0.0f; // Initialize segment time
     float time_var = dt_max; // Time worker variable
     float mm_var; // mm-Distance worker variable
-    float speed_var; // Speed worker variable
     float mm_remaining = pl_block->millimeters; // New segment distance from end of block.
     float minimum_mm = mm_remaining-prep.req_mm_increment; // Guarantee at least one step.
     if (minimum_mm < 0.0f) { minimum_mm = 0.0f; }
 
     do {
+      #ifdef S_CURVE_ACCELERATION
+        if (!st_scurve_segment(&time_var, &mm_remaining))
+      #endif
       switch (prep.ramp_type) {
         case RAMP_DECEL_OVERRIDE:
           speed_var = pl_block->acceleration*time_var;
@@ -1026,7 +2396,11 @@ void st_prep_buffer()
           prep.current_speed = prep.exit_speed;
       }
       dt += time_var; // Add computed ramp time to total segment time.
-      if (dt < dt_max) { time_var = dt_max - dt; } // **Incomplete** At ramp junction.
+      if (dt < dt_max) { // **Incomplete** At ramp junction.
+        // A cruising segment that runs into a ramp is cut at the ramp segment time past the junction.
+        if ((prep.ramp_type != RAMP_CRUISE) && (dt_max > dt+DT_SEGMENT)) { dt_max = dt+DT_SEGMENT; }
+        time_var = dt_max - dt;
+      }
       else {
         if (mm_remaining > minimum_mm) { // Check for very slow segments with zero steps.
           // Increase segment time to ensure at least one step in segment. Override and loop
@@ -1087,6 +2461,9 @@ void st_prep_buffer()
         #ifdef PARKING_ENABLE
           if (!(prep.recalculate_flag & PREP_FLAG_PARKING)) { prep.recalculate_flag |= PREP_FLAG_HOLD_PARTIAL_BLOCK; }
         #endif
+        #ifdef INPUT_SHAPING
+          st_shaper_stop();
+        #endif
         return; // Segment not generated, but current step data still retained.
       }
     }
@@ -1099,51 +2476,29 @@ void st_prep_buffer()
     // adjusts the whole segment rate to keep step output exact. These rate adjustments are
     // typically very small and do not adversely effect performance, but ensures that Grbl
     // outputs the exact acceleration and velocity profiles as computed by the planner.
-    dt += prep.dt_remainder; // Apply previous segment partial step execute time
-    float inv_rate = dt/(last_n_steps_remaining - step_dist_remaining); // Compute adjusted step rate inverse
-
-    // Compute CPU cycles per step for the prepped segment.
-	uint32_t cycles = (uint32_t)ceilf((TICKS_PER_MICROSECOND * 1000000) *inv_rate * 60); // (cycles/step)
-
-    #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-      // Compute step timing and multi-axis smoothing level.
-      // NOTE: AMASS overdrives the timer with each level, so only one prescalar is required.
-      if (cycles < AMASS_LEVEL1) { prep_segment->amass_level = 0; }
-      else {
-        if (cycles < AMASS_LEVEL2) { prep_segment->amass_level = 1; }
-        else if (cycles < AMASS_LEVEL3) { prep_segment->amass_level = 2; }
-        else { prep_segment->amass_level = 3; }
-        cycles >>= prep_segment->amass_level;
-        prep_segment->n_step <<= prep_segment->amass_level;
-      }
-      if (cycles < (1UL << 16)) { prep_segment->cycles_per_tick = cycles; } // < 65536 (4.1ms @ 16MHz)
-      else { prep_segment->cycles_per_tick = 0xffff; } // Just set the slowest speed possible.
+    #ifdef INPUT_SHAPING
+      // Queue the segment in the input shaper, which applies the correction to the shaped time.
+      shaper_segment_t *queued = &shaper.segment[shaper.head];
+      queued->dt = dt;
+      queued->mm = pl_block->millimeters - mm_remaining;
+      queued->speed = ((dt > 0.0f) ? queued->mm/dt : 0.0f);
+      queued->steps = last_n_steps_remaining - step_dist_remaining;
+      queued->partial_step = n_steps_remaining - step_dist_remaining;
+      shaper.head = st_shaper_next(shaper.head);
     #else
-      // Compute step timing and timer prescalar for normal step generation.
-      if (cycles < (1UL << 16)) { // < 65536  (4.1ms @ 16MHz)
-        prep_segment->prescaler = 1; // prescaler: 0
-        prep_segment->cycles_per_tick = cycles;
-      } else if (cycles < (1UL << 19)) { // < 524288 (32.8ms@16MHz)
-        prep_segment->prescaler = 2; // prescaler: 8
-        prep_segment->cycles_per_tick = cycles >> 3;
-      } else {
-        prep_segment->prescaler = 3; // prescaler: 64
-        if (cycles < (1UL << 22)) { // < 4194304 (262ms@16MHz)
-          prep_segment->cycles_per_tick =  cycles >> 6;
-        } else { // Just set the slowest speed possible. (Around 4 step/sec.)
-          prep_segment->cycles_per_tick = 0xffff;
-        }
-      }
+      dt += prep.dt_remainder; // Apply previous segment partial step execute time
+      float inv_rate = dt/(last_n_steps_remaining - step_dist_remaining); // Compute adjusted step rate inverse
+      st_set_segment_rate(prep_segment, inv_rate);
+      prep.dt_remainder = (n_steps_remaining - step_dist_remaining)*inv_rate;
+
+      // Segment complete! Increment segment buffer indices, so stepper ISR can immediately execute it.
+      segment_buffer_head = segment_next_head;
+      if ( ++segment_next_head == SEGMENT_BUFFER_SIZE ) { segment_next_head = 0; }
     #endif
 
-    // Segment complete! Increment segment buffer indices, so stepper ISR can immediately execute it.
-    segment_buffer_head = segment_next_head;
-    if ( ++segment_next_head == SEGMENT_BUFFER_SIZE ) { segment_next_head = 0; }
-
     // Update the appropriate planner and segment data.
     pl_block->millimeters = mm_remaining;
     prep.steps_remaining = n_steps_remaining;
-    prep.dt_remainder = (n_steps_remaining - step_dist_remaining)*inv_rate;
 
     // Check for exit conditions and flag to load next planner block.
     if (mm_remaining == prep.mm_complete) {
@@ -1156,11 +2511,17 @@ void st_prep_buffer()
         #ifdef PARKING_ENABLE
           if (!(prep.recalculate_flag & PREP_FLAG_PARKING)) { prep.recalculate_flag |= PREP_FLAG_HOLD_PARTIAL_BLOCK; }
         #endif
+        #ifdef INPUT_SHAPING
+          st_shaper_stop();
+        #endif
         return; // Bail!
       } else { // End of planner block
         // The planner block is complete. All steps are set to be executed in the segment buffer.
         if (sys.step_control & STEP_CONTROL_EXECUTE_SYS_MOTION) {
           bit_true(sys.step_control,STEP_CONTROL_END_MOTION);
+          #ifdef INPUT_SHAPING
+            st_shaper_stop();
+          #endif
           return;
         }
         pl_block = NULL; // Set pointer to indicate check and load next planner block.
@@ -1172,6 +2533,25 @@ void st_prep_buffer()
 }
 
 
+// Prepares the step segment buffer, and measures the segment prep CPU load. See st_prep_segments().
+void st_prep_buffer()
+{
+  #ifdef STM32F103C8
+    uint32_t prep_start = DWT_CYCCNT;
+    uint8_t head = segment_buffer_head;
+    if (prep_start - st_prep_last_call < ST_PREP_MAX_GAP) { st_prep_run_cycles += prep_start - st_prep_last_call; }
+    st_prep_last_call = prep_start;
+  #endif
+  st_prep_segments();
+  #ifdef STM32F103C8
+    if (segment_buffer_head != head) {
+      st_prep_busy_cycles += DWT_CYCCNT - prep_start;
+      st_prep_segment_count += (segment_buffer_head + SEGMENT_BUFFER_SIZE - head) % SEGMENT_BUFFER_SIZE;
+    }
+  #endif
+}
+
+
 // Called by realtime status reporting to fetch the current speed being executed. This value
 // however is not exactly the current speed, but the speed computed in the last step segment
 // in the segment buffer. It will always be behind by up to the number of segment blocks (-1)
@@ -1183,6 +2563,58 @@ float st_get_realtime_rate()
   }
   return 0.0f;
 }
+
+
+#ifdef STM32F103C8
+  // Returns the highest step rate in Hz the step generator keeps up with. A tick must outlast the
+  // step pulse and, on the stepper interrupt, its worst execution time measured since power up.
+  // isr_cycles returns that time, zero until the first motion.
+  uint32_t st_get_max_step_rate(uint32_t *isr_cycles)
+  {
+    *isr_cycles = st_isr_cycles_peak;
+    #ifdef STEP_DMA_BSRR
+      uint32_t pulse_periods = ((uint32_t)settings.pulse_microseconds*STEP_DMA_FREQUENCY + 999999)/1000000;
+      return(STEP_DMA_FREQUENCY/(max(pulse_periods, 1) + 1));
+    #elif defined(STEP_PER_AXIS_TIMING)
+      // A step is two interrupts per axis, and all the axes may step at once.
+      uint32_t cycles = (uint32_t)settings.pulse_microseconds*TICKS_PER_MICROSECOND + ST_AXIS_LEAD;
+      if (2*N_AXIS*st_isr_cycles_peak > cycles) { cycles = 2*N_AXIS*st_isr_cycles_peak; }
+      return(F_CPU/cycles);
+    #else
+      uint32_t cycles = (uint32_t)settings.pulse_microseconds*TICKS_PER_MICROSECOND + 1;
+      if (st_isr_cycles_peak > cycles) { cycles = st_isr_cycles_peak; }
+      return(F_CPU/cycles);
+    #endif
+  }
+#endif
+
+#ifdef STM32F103C8
+  // Returns the segment prep CPU load in percent, and the mean CPU cycles per segment, since the last
+  // call. The load is of the time motion ran, and includes the stepper interrupts taken while prepping.
+  float st_get_prep_load(uint32_t *segment_cycles)
+  {
+    float load = 0.0f;
+    *segment_cycles = 0;
+    if (st_prep_run_cycles > 0) { load = (100.0f*st_prep_busy_cycles)/st_prep_run_cycles; }
+    if (st_prep_segment_count > 0) { *segment_cycles = st_prep_busy_cycles/st_prep_segment_count; }
+    st_prep_busy_cycles = 0;
+    st_prep_run_cycles = 0;
+    st_prep_segment_count = 0;
+    return(load);
+  }
+#endif
+
+#ifdef DEBUG
+  // Returns the worst stepper interrupt latency and execution time in CPU cycles, and restarts them.
+  void st_get_isr_cycles(uint32_t *latency, uint32_t *cycles)
+  {
+    *latency = st_isr_latency_max;
+    *cycles = st_isr_cycles_max;
+    st_isr_latency_max = 0;
+    st_isr_cycles_max = 0;
+  }
+#endif
+
 #ifdef STM32F103C8
 void TIM_Configuration(TIM_TypeDef* TIMER, u16 Period, u16 Prescaler, u8 PP)
 {
@@ -30,6 +30,17 @@
 #endif
 #endif
 
+#ifdef INPUT_SHAPING
+  #ifndef SHAPER_BUFFER_SIZE
+    #define SHAPER_BUFFER_SIZE 48
+  #endif
+
+  // Input shaper types, setting $36.
+  #define SHAPER_OFF 0
+  #define SHAPER_ZV  1
+  #define SHAPER_ZVD 2
+#endif
+
 // Initialize and setup the stepper motor subsystem
 void stepper_init();
 
@@ -54,12 +65,40 @@ void st_parking_restore_buffer();
 // Reloads step segment buffer. Called continuously by realtime execution system.
 void st_prep_buffer();
 
+#ifdef INPUT_SHAPING
+  // Sets up the input shaper from settings $36-$38. Returns false, if they do not give a shaper.
+  uint8_t st_shaper_init();
+#endif
+
+// Returns the machine position in motor steps at this instant, including the executing segment.
+// sys_position[] only advances as each segment completes.
+void st_get_position(int32_t *position);
+
 // Called by planner_recalculate() when the executing block is updated by the new plan.
 void st_update_plan_block_parameters();
 
 // Called by realtime status reporting if realtime rate reporting is enabled in config.h.
 float st_get_realtime_rate();
 
+#ifdef STM32F103C8
+  // Cortex-M3 DWT cycle counter. Not defined by this CMSIS version. Enabled by stepper_init().
+  #define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+  #define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+  #define DWT_CTRL_CYCCNTENA bit(0)
+
+  // Returns the step rate ceiling in Hz and the worst measured stepper interrupt time, for $I.
+  uint32_t st_get_max_step_rate(uint32_t *isr_cycles);
+
+  // Returns the segment prep CPU load in percent since the last call, and the mean CPU cycles it
+  // took per segment in segment_cycles, for $I.
+  float st_get_prep_load(uint32_t *segment_cycles);
+#endif
+
+#ifdef DEBUG
+  // Returns the worst stepper interrupt latency and execution time in CPU cycles since the last call.
+  void st_get_isr_cycles(uint32_t *latency, uint32_t *cycles);
+#endif
+
 extern const PORTPINDEF step_pin_mask[N_AXIS];
 extern const PORTPINDEF direction_pin_mask[N_AXIS];
 extern const PORTPINDEF limit_pin_mask[N_AXIS];
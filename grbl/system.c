@@ -173,6 +173,12 @@ uint8_t system_execute_line(char *line)
     case 'J' : // Jogging
       // Execute only if in IDLE or JOG states.
       if (sys.state != STATE_IDLE && sys.state != STATE_JOG) { return(STATUS_IDLE_ERROR); }
+      #ifdef TEACH_AND_REPLAY
+        if (teach_recording()) { return(STATUS_IDLE_ERROR); } // The machine is behind the planner.
+      #endif
+      #ifdef IS_SCARA
+        if ((line[2] == 'J') && (line[3] == '=')) { return(jog_joint_execute_line(line)); }
+      #endif
       if(line[2] != '=') { return(STATUS_INVALID_STATEMENT); }
       return(gc_execute_line(line)); // NOTE: $J= is ignored inside g-code parser and used to detect jog motions.
       break;
@@ -222,6 +228,9 @@ uint8_t system_execute_line(char *line)
         case 'H' : // Perform homing cycle [IDLE/ALARM]
           if (bit_isfalse(settings.flags,BITFLAG_HOMING_ENABLE)) {return(STATUS_SETTING_DISABLED); }
           if (system_check_safety_door_ajar()) { return(STATUS_CHECK_DOOR); } // Block if safety door is ajar.
+          #ifdef TEACH_AND_REPLAY
+            if (teach_recording()) { return(STATUS_IDLE_ERROR); }
+          #endif
           sys.state = STATE_HOMING; // Set system state variable
           sys_home_state = true;
           if (line[2] == 0) {
@@ -242,6 +251,14 @@ uint8_t system_execute_line(char *line)
             if (line[2] == 0) { system_execute_startup(line); }
           }
           break;
+        #ifdef IS_SCARA
+        case 'K' : // SCARA kinematic calibration [IDLE/ALARM]
+          return(scara_calibration_execute_line(line));
+        #endif
+        #ifdef TEACH_AND_REPLAY
+        case 'T' : // Teach and replay [IDLE/ALARM]
+          return(teach_execute_line(line));
+        #endif
         case 'S' : // Puts Grbl to sleep [IDLE/ALARM]
           if ((line[2] != 'L') || (line[3] != 'P') || (line[4] != 0)) { return(STATUS_INVALID_STATEMENT); }
           system_set_exec_state_flag(EXEC_SLEEP); // Set to execute sleep mode immediately
@@ -335,60 +352,31 @@ void system_flag_wco_change()
 //   serves as a central place to compute the transformation.
 float system_convert_axis_steps_to_mpos(int32_t *steps, uint8_t idx)
 {
-  float pos;
-  #ifdef COREXY
-    if (idx==X_AXIS) {
-      pos = (float)system_convert_corexy_to_x_axis_steps(steps) / settings.steps_per_mm[idx];
-    } else if (idx==Y_AXIS) {
-      pos = (float)system_convert_corexy_to_y_axis_steps(steps) / settings.steps_per_mm[idx];
-    } else {
-      pos = steps[idx]/settings.steps_per_mm[idx];
-    }
-  #else
-    pos = steps[idx]/settings.steps_per_mm[idx];
-  #endif
-  return(pos);
+  return(kinematics_axis_position(steps, idx));
 }
 
 
+// Updates a machine 'position' array based on the 'step' array sent.
 void system_convert_array_steps_to_mpos(float *position, int32_t *steps)
 {
-    uint8_t idx;
-#if IS_SCARA
-	float position_scara[3];
-    for (idx=0; idx<N_AXIS; idx++)
-    {
-        position_scara[idx] = system_convert_axis_steps_to_mpos(steps, idx);
-    }
-		forward_kinematics_SCARA(position_scara,position);
-#else
-    for (idx=0; idx<N_AXIS; idx++)
-    {
-        position[idx] = system_convert_axis_steps_to_mpos(steps, idx);
-    }
-#endif
-  return;
+  int32_t axis_steps[N_AXIS];
+  kinematics_motor_to_axis_steps(axis_steps, steps);
+  kinematics_forward(position, axis_steps);
 }
 
 
-// CoreXY calculation only. Returns x or y-axis "steps" based on CoreXY motor steps.
-#ifdef COREXY
-  int32_t system_convert_corexy_to_x_axis_steps(int32_t *steps)
-  {
-    return( (steps[A_MOTOR] + steps[B_MOTOR])/2 );
-  }
-  int32_t system_convert_corexy_to_y_axis_steps(int32_t *steps)
-  {
-    return( (steps[A_MOTOR] - steps[B_MOTOR])/2 );
-  }
-#endif
-
-
 // Checks and reports if target array exceeds machine travel limits.
 uint8_t system_check_travel_limits(float *target)
+{
+  if (kinematics_check_travel_limits(target)) { return(true); }
+  return(system_check_linear_travel_limits(target));
+}
+
+
+uint8_t system_check_linear_travel_limits(float *target)
 {
   uint8_t idx;
-  for (idx=0; idx<N_AXIS; idx++) {
+  for (idx=KINEMATICS_FIRST_LINEAR_AXIS; idx<N_AXIS; idx++) {
     #ifdef HOMING_FORCE_SET_ORIGIN
       // When homing forced set origin is enabled, soft limits checks need to account for directionality.
       // NOTE: max_travel is stored as negative
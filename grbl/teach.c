@@ -0,0 +1,352 @@
+/*
+  teach.c - Teach and replay of planned motion
+  Part of Grbl
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "grbl.h"
+
+#ifdef TEACH_AND_REPLAY
+
+#include "stm32f10x_flash.h"
+
+#define TEACH_FLASH_PAGE_SIZE 0x400
+#ifdef S_CURVE_ACCELERATION
+  #define TEACH_MAGIC (0x54434A00 | SETTINGS_VERSION) // "TCJ" and the settings version. Records hold the jerk.
+#else
+  #define TEACH_MAGIC (0x54434800 | SETTINGS_VERSION) // "TCH" and the settings version
+#endif
+
+// Flash layout: the header, followed by the records. The header is written when a recording stops,
+// its magic last, so an interrupted recording never reads as valid.
+typedef struct {
+  uint32_t magic;
+  uint32_t count;          // Number of records
+  int32_t start[N_AXIS];   // Planner position at the start of the recording in axis steps
+} teach_header_t;
+
+// A planned block, or a spindle, coolant or dwell command. Blocks keep the plan_block_t fields that
+// do not change once planned. Commands keep their state and value in accessory and value.
+typedef struct {
+  uint8_t type;
+  uint8_t condition;
+  uint8_t direction_bits;
+  uint8_t accessory;
+  uint32_t steps[N_AXIS];
+  uint32_t step_event_count;
+  int32_t target[N_AXIS];  // Planner position at the end of the block in axis steps
+  float millimeters;
+  float acceleration;
+  #ifdef S_CURVE_ACCELERATION
+    float jerk;
+  #endif
+  float max_junction_speed_sqr;
+  float rapid_rate;
+  float programmed_rate;
+  float value;             // Block or spindle rpm, or dwell time in seconds
+  #ifdef USE_LINE_NUMBERS
+    int32_t line_number;
+  #endif
+} teach_record_t;
+
+#define TEACH_HEADER ((teach_header_t const *)TEACH_FLASH_START)
+#define TEACH_RECORDS ((teach_record_t const *)(TEACH_FLASH_START + sizeof(teach_header_t)))
+#define TEACH_MAX_RECORDS ((TEACH_FLASH_PAGES*TEACH_FLASH_PAGE_SIZE - sizeof(teach_header_t))/sizeof(teach_record_t))
+
+// Teach states
+#define TEACH_IDLE      0
+#define TEACH_RECORDING 1
+#define TEACH_FAILED    2 // Recording overflowed, failed to write or lost track of the planner position.
+
+// NOTE: A flash write stalls the CPU for the ~1.4 ms a record takes, which would starve the stepper
+// interrupt. Nothing is executed between $TR and $TS, so recording never overlaps stepping. The
+// planner plans each block as if queued, and discards it once recorded, like check mode.
+static struct {
+  uint8_t state;
+  uint32_t count;
+  int32_t start[N_AXIS];
+  int32_t position[N_AXIS]; // End of the last recorded block
+  uint8_t spindle;          // Parser spindle and coolant states at $TR, which recording does not change.
+  uint8_t coolant;
+  float spindle_speed;
+} teach;
+
+
+// Programs size bytes, an even number, into erased flash. Returns false if any write failed.
+static uint8_t teach_flash_write(uint32_t address, void const *data, uint16_t size)
+{
+  uint16_t const *half_word = (uint16_t const *)data;
+  for (; size > 0; size -= 2) {
+    if (FLASH_ProgramHalfWord(address, *half_word++) != FLASH_COMPLETE) { return(false); }
+    address += 2;
+  }
+  return(true);
+}
+
+
+static void teach_append(teach_record_t *record)
+{
+  if (teach.count >= TEACH_MAX_RECORDS) { teach.state = TEACH_FAILED; return; }
+  uint32_t address = TEACH_FLASH_START + sizeof(teach_header_t) + teach.count*sizeof(teach_record_t);
+  if (!teach_flash_write(address, record, sizeof(teach_record_t))) {
+    teach.state = TEACH_FAILED;
+    return;
+  }
+  teach.count++;
+}
+
+
+// The erased flash holds no valid header, so the recording is lost. Reset re-syncs the planner and
+// parser positions to the machine.
+void teach_reset()
+{
+  teach.state = TEACH_IDLE;
+}
+
+
+uint8_t teach_recording()
+{
+  return(teach.state != TEACH_IDLE);
+}
+
+
+void teach_break()
+{
+  if (teach.state == TEACH_RECORDING) { teach.state = TEACH_FAILED; }
+}
+
+
+uint8_t teach_record_block(plan_block_t *block, int32_t *position_steps, int32_t *target_steps)
+{
+  if (teach.state != TEACH_RECORDING) { return(teach_recording()); }
+  // Jog motions are not part of the program, and are rejected while recording. Anything else that
+  // moved the planner position between recorded blocks breaks the recording. Replayed blocks would
+  // no longer join up.
+  if ((block->condition & PL_COND_FLAG_NO_FEED_OVERRIDE) ||
+      memcmp(position_steps, teach.position, sizeof(teach.position))) {
+    teach.state = TEACH_FAILED;
+    return(true);
+  }
+
+  teach_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.type = TEACH_RECORD_BLOCK;
+  record.condition = block->condition;
+  record.direction_bits = block->direction_bits;
+  memcpy(record.steps, block->steps, sizeof(record.steps));
+  record.step_event_count = block->step_event_count;
+  memcpy(record.target, target_steps, sizeof(record.target));
+  record.millimeters = block->millimeters;
+  record.acceleration = block->acceleration;
+  #ifdef S_CURVE_ACCELERATION
+    record.jerk = block->jerk;
+  #endif
+  record.max_junction_speed_sqr = block->max_junction_speed_sqr;
+  record.rapid_rate = block->rapid_rate;
+  record.programmed_rate = block->programmed_rate;
+  #ifdef VARIABLE_SPINDLE
+    record.value = block->spindle_speed;
+  #endif
+  #ifdef USE_LINE_NUMBERS
+    record.line_number = block->line_number;
+  #endif
+  teach_append(&record);
+  memcpy(teach.position, target_steps, sizeof(teach.position));
+  return(true);
+}
+
+
+uint8_t teach_record_command(uint8_t type, uint8_t state, float value)
+{
+  if (teach.state != TEACH_RECORDING) { return(teach_recording()); }
+  teach_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  record.accessory = state;
+  record.value = value;
+  teach_append(&record);
+  return(true);
+}
+
+
+static uint8_t teach_start()
+{
+  if (sys.state != STATE_IDLE) { return(STATUS_IDLE_ERROR); }
+  if (teach.state != TEACH_IDLE) { return(STATUS_TEACH_INVALID); } // Planner is ahead of the machine.
+  uint32_t address;
+  for (address = TEACH_FLASH_START; address < TEACH_FLASH_START + TEACH_FLASH_PAGES*TEACH_FLASH_PAGE_SIZE;
+       address += TEACH_FLASH_PAGE_SIZE) {
+    if (FLASH_ErasePage(address) != FLASH_COMPLETE) {
+      teach.state = TEACH_FAILED;
+      return(STATUS_TEACH_INVALID);
+    }
+  }
+  plan_get_planner_steps(teach.start);
+  memcpy(teach.position, teach.start, sizeof(teach.position));
+  teach.spindle = gc_state.modal.spindle;
+  teach.coolant = gc_state.modal.coolant;
+  teach.spindle_speed = gc_state.spindle_speed;
+  teach.count = 0;
+  teach.state = TEACH_RECORDING;
+  plan_start_from_rest(); // The first recorded block starts from rest, as it does in a replay.
+  return(STATUS_OK);
+}
+
+
+static uint8_t teach_stop()
+{
+  if (teach.state == TEACH_IDLE) { return(STATUS_OK); }
+  // The machine has not moved since $TR. Return the planner and parser to it.
+  plan_sync_position();
+  plan_start_from_rest();
+  gc_sync_position();
+  gc_state.modal.spindle = teach.spindle;
+  gc_state.modal.coolant = teach.coolant;
+  gc_state.spindle_speed = teach.spindle_speed;
+  if (teach.state == TEACH_FAILED) {
+    teach.state = TEACH_IDLE;
+    return(STATUS_TEACH_INVALID);
+  }
+  teach.state = TEACH_IDLE;
+  teach_header_t header;
+  header.magic = TEACH_MAGIC;
+  header.count = teach.count;
+  memcpy(header.start, teach.start, sizeof(header.start));
+  uint8_t offset = sizeof(header.magic);
+  if (!teach_flash_write(TEACH_FLASH_START+offset, (uint8_t *)&header+offset, sizeof(header)-offset) ||
+      !teach_flash_write(TEACH_FLASH_START, &header.magic, sizeof(header.magic))) {
+    return(STATUS_TEACH_INVALID);
+  }
+  return(STATUS_OK);
+}
+
+
+// Waits for room in the planner buffer, as mc_buffer_line() does. Returns false upon an abort.
+static uint8_t teach_wait_for_buffer()
+{
+  do {
+    protocol_execute_realtime(); // Check for any run-time commands
+    if (sys.abort) { return(false); } // Bail, if system abort.
+    if ( plan_check_full_buffer() ) { protocol_auto_cycle_start(); } // Auto-cycle start when buffer is full.
+    else { break; }
+  } while (1);
+  return(true);
+}
+
+
+static uint8_t teach_replay()
+{
+  if (sys.state != STATE_IDLE) { return(STATUS_IDLE_ERROR); }
+  teach_header_t const *header = TEACH_HEADER;
+  if ((teach.state != TEACH_IDLE) || (header->magic != TEACH_MAGIC) || (header->count > TEACH_MAX_RECORDS)) {
+    return(STATUS_TEACH_INVALID);
+  }
+  int32_t position[N_AXIS];
+  plan_get_planner_steps(position);
+  if (memcmp(position, header->start, sizeof(position))) { return(STATUS_TEACH_NOT_AT_START); }
+
+  plan_block_t block;
+  uint8_t from_rest = true;
+  uint32_t n;
+  for (n=0; n<header->count; n++) {
+    teach_record_t const *record = &TEACH_RECORDS[n];
+    switch (record->type) {
+      case TEACH_RECORD_BLOCK:
+        if (!teach_wait_for_buffer()) { return(STATUS_OK); }
+        memset(&block, 0, sizeof(block));
+        memcpy(block.steps, record->steps, sizeof(block.steps));
+        block.step_event_count = record->step_event_count;
+        block.direction_bits = record->direction_bits;
+        block.condition = record->condition;
+        block.millimeters = record->millimeters;
+        block.acceleration = record->acceleration;
+        #ifdef S_CURVE_ACCELERATION
+          block.jerk = record->jerk;
+        #endif
+        block.max_junction_speed_sqr = record->max_junction_speed_sqr;
+        block.rapid_rate = record->rapid_rate;
+        block.programmed_rate = record->programmed_rate;
+        #ifdef VARIABLE_SPINDLE
+          block.spindle_speed = record->value;
+        #endif
+        #ifdef USE_LINE_NUMBERS
+          block.line_number = record->line_number;
+        #endif
+        plan_buffer_recorded_block(&block, (int32_t *)record->target, from_rest);
+        from_rest = false;
+        break;
+      case TEACH_RECORD_SPINDLE:
+        spindle_sync(record->accessory, record->value);
+        gc_state.modal.spindle = record->accessory;
+        gc_state.spindle_speed = record->value;
+        break;
+      case TEACH_RECORD_COOLANT:
+        coolant_sync(record->accessory);
+        gc_state.modal.coolant = record->accessory;
+        break;
+      case TEACH_RECORD_DWELL:
+        mc_dwell(record->value);
+        break;
+    }
+    if (sys.abort) { return(STATUS_OK); }
+  }
+  plan_start_from_rest(); // The direction the last recorded block ends in is not kept.
+  plan_get_planner_mpos(gc_state.position); // The parser continues from the end of the recording.
+  protocol_auto_cycle_start();
+  return(STATUS_OK);
+}
+
+
+static void teach_report()
+{
+  teach_header_t const *header = TEACH_HEADER;
+  printPgmString(PSTR("[TEACH:"));
+  if (teach.state == TEACH_RECORDING) {
+    serial_write('R');
+    serial_write(',');
+    print_uint32_base10(teach.count);
+  } else if (header->magic == TEACH_MAGIC) {
+    float start[N_AXIS];
+    kinematics_forward(start, (int32_t *)header->start);
+    serial_write('V');
+    serial_write(',');
+    print_uint32_base10(header->count);
+    serial_write(':');
+    uint8_t idx;
+    for (idx=0; idx<N_AXIS; idx++) {
+      printFloat_CoordValue(start[idx]);
+      if (idx < (N_AXIS-1)) { serial_write(','); }
+    }
+  } else {
+    serial_write('E');
+  }
+  printPgmString(PSTR("]\r\n"));
+}
+
+
+uint8_t teach_execute_line(char *line)
+{
+  if ((line[2] != 0) && (line[3] != 0)) { return(STATUS_INVALID_STATEMENT); }
+  switch (line[2]) {
+    case 0 : teach_report(); break;
+    case 'R' : return(teach_start());
+    case 'S' : return(teach_stop());
+    case 'P' : return(teach_replay());
+    default : return(STATUS_INVALID_STATEMENT);
+  }
+  return(STATUS_OK);
+}
+
+#endif
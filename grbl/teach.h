@@ -0,0 +1,59 @@
+/*
+  teach.h - Teach and replay of planned motion
+  Part of Grbl
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef teach_h
+#define teach_h
+
+#ifdef TEACH_AND_REPLAY
+
+// Recorded command types
+#define TEACH_RECORD_BLOCK   0
+#define TEACH_RECORD_SPINDLE 1
+#define TEACH_RECORD_COOLANT 2
+#define TEACH_RECORD_DWELL   3
+
+// Executes a $T teach and replay command. See TEACH_AND_REPLAY in config.h.
+//   $T    Reports the recording as [TEACH:<E|R|V>,<records>:<start machine position>], where E is
+//         empty or invalid, R recording and V a valid recording.
+//   $TR   Erases the flash region and starts recording at the current planner position. [IDLE]
+//   $TS   Stops recording, stores the recording and returns the parser to the machine position.
+//   $TP   Replays the recording. The machine must be at its start position. [IDLE]
+uint8_t teach_execute_line(char *line);
+
+// Stops an unfinished recording, which leaves it invalid. Called upon reset.
+void teach_reset();
+
+// Returns true from $TR until $TS. Motions and commands are then recorded instead of executed, so
+// that no flash write ever overlaps stepping.
+uint8_t teach_recording();
+
+// Leaves the recording invalid, for a motion it can not hold, like a probe cycle.
+void teach_break();
+
+// Records a planned block, ending at target_steps[N_AXIS] in planner axis steps. The planner calls
+// this before it moves its position from the block start, position_steps[N_AXIS], to the target.
+// Returns true if recording, and the planner then discards the block.
+uint8_t teach_record_block(plan_block_t *block, int32_t *position_steps, int32_t *target_steps);
+
+// Records a spindle, coolant or dwell command. Value is the spindle rpm or dwell time in seconds.
+// Returns true if recording, and the caller then skips the command.
+uint8_t teach_record_command(uint8_t type, uint8_t state, float value);
+
+#endif
+
+#endif